@@ -0,0 +1,59 @@
+// Reports how many bytes each entity costs per subsystem and how many
+// entities fit in a typical L2 cache.
+//
+// Build and run with `make bench`.
+
+#include "../src/shared.h"
+
+#define L2_CACHE_SIZE (256 * 1024)
+
+// The entity record before the compact layout, kept for comparison.
+typedef struct legacy_entity {
+	AABB aabb;
+	vec2 velocity;
+	vec2 last_velocity;
+	vec2 desired_velocity;
+	vec2 acceleration;
+	f32 rotation;
+	u32 animation_id;
+	vec2 sprite_size;
+	vec2 sprite_offset;
+	vec4 sprite_color;
+	vec4 desired_sprite_color;
+	vec4 sprite_color_delta;
+	On_Collide_Function on_collide;
+	On_Collide_Static_Function on_collide_static;
+	f32 time_to_live;
+	u8 is_in_use;
+	u8 is_flipped;
+	u8 is_grounded;
+	u8 is_kinematic;
+	u8 layer_mask;
+	i8 health;
+} Legacy_Entity;
+
+static void report(const char *name, size_t bytes) {
+	printf("%-32s %6zu bytes %8zu per L2\n", name, bytes, bytes ? L2_CACHE_SIZE / bytes : 0);
+}
+
+int main(void) {
+	size_t tag_bytes = MAX_ENTITY_TAGS * (sizeof(u32) + sizeof(u16));
+
+	printf("Per entity slot\n");
+	report("Legacy entity", sizeof(Legacy_Entity));
+	report("Entity (hot, simulated)", sizeof(Entity));
+	report("Tag sets (all tags)", tag_bytes);
+
+	printf("\nPer active item\n");
+	report("Timer", sizeof(Timer));
+	report("Colour tween", sizeof(u32) + 5 * sizeof(f32) + 2 * sizeof(vec4));
+
+	printf("\nShared\n");
+	report("Entity type", sizeof(Entity_Type));
+	report("Entity type table", sizeof(Entity_Type) * MAX_ENTITY_TYPES);
+
+	printf("\nHot entity array is %zu bytes for %d entities (%.1fx the legacy density)\n",
+	       sizeof(Entity) * MAX_ENTITIES, MAX_ENTITIES, (f64)sizeof(Legacy_Entity) / sizeof(Entity));
+
+	return 0;
+}
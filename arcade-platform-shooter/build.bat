@@ -1,2 +1,2 @@
-CL /Zi /I .\deps\include /I C:\include ./src/main.c ./deps/src/glad.c ./src/engine/io/io.c ./src/sprite.c ./src/audio.c ./src/util.c ./src/shared.c ./src/render.c ./src/input.c ./src/engine/config/config.c ./src/engine/config/config_init.c ./src/physics.c ./src/entity.c /link C:\libs\SDL2main.lib C:\libs\SDL2.lib C:\libs\SDL2_mixer.lib C:\libs\freetype.lib
+CL /Zi /I .\deps\include /I C:\include ./src/main.c ./deps/src/glad.c ./src/engine/io/io.c ./src/sprite.c ./src/audio.c ./src/util.c ./src/shared.c ./src/render.c ./src/render_soft.c ./src/input.c ./src/engine/config/config.c ./src/engine/config/config_init.c ./src/physics.c ./src/entity.c ./src/timer.c ./src/tween.c ./src/projectile.c ./src/profile.c /link C:\libs\SDL2main.lib C:\libs\SDL2.lib C:\libs\SDL2_mixer.lib
 
@@ -3,7 +3,13 @@ out vec4 frag_color;
 
 in vec2 uvs;
 
+// Single sprites set the colour per draw, the batch per instance.
+#ifdef UNIFORM_COLOR
 uniform vec4 color;
+#else
+in vec4 color;
+#endif
+
 uniform sampler2D texture_id;
 
 void main() {
@@ -0,0 +1,24 @@
+#version 330 core
+layout (location = 0) in vec2 a_corner;
+layout (location = 1) in vec2 a_position;
+layout (location = 2) in vec2 a_size;
+layout (location = 3) in vec4 a_uv_rect;
+layout (location = 4) in float a_rotation;
+layout (location = 5) in vec4 a_color;
+
+out vec2 uvs;
+out vec4 color;
+
+uniform mat4 projection;
+
+void main() {
+	// Scale (a negative width flips), rotate, then move to the centre.
+	vec2 local = a_corner * a_size;
+	float c = cos(a_rotation);
+	float s = sin(a_rotation);
+	vec2 world = a_position + vec2(local.x * c - local.y * s, local.x * s + local.y * c);
+
+	uvs = mix(a_uv_rect.xy, a_uv_rect.zw, a_corner + 0.5);
+	color = a_color;
+	gl_Position = projection * vec4(world, 0.0, 1.0);
+}
@@ -1,19 +1,21 @@
 #version 330 core
+out vec4 frag_color;
 
-out vec4 FragColor;
+in vec2 local;
+in float radius;
+in float thickness;
+in vec4 color;
 
-uniform vec4 color;
-uniform vec2 position;
-uniform float radius;
+#include "sdf.glsl"
 
 void main() {
-	// Start at the pixel offset by the position minus radius divided by the diameter.
-	vec2 st = vec2(gl_FragCoord.x - position.x + radius, gl_FragCoord.y - position.y + radius)/vec2(radius * 2);
-	float pct = distance(st, vec2(0.5));
-        if (pct > 0.5) {
-		FragColor = vec4(0);
-        } else {
-		FragColor = color;
-        }
-}
+	// Signed distance to the ring, negative inside it. Fade over about a
+	// screen pixel either side of the edge.
+	float d = length(local);
+	float ring = abs(d - (radius - thickness * 0.5)) - thickness * 0.5;
+	float alpha = 1.0 - sdf_coverage(ring, 0.0, fwidth(d));
+	if (alpha <= 0.0)
+		discard;
 
+	frag_color = vec4(color.rgb, color.a * alpha);
+}
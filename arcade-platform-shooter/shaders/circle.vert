@@ -1,9 +1,22 @@
 #version 330 core
-layout (location = 0) in vec3 a_pos;
+layout (location = 0) in vec2 a_corner;
+layout (location = 1) in vec2 a_position;
+layout (location = 2) in float a_radius;
+layout (location = 3) in float a_thickness;
+layout (location = 4) in vec4 a_color;
+
+out vec2 local;
+out float radius;
+out float thickness;
+out vec4 color;
 
 uniform mat4 projection;
-uniform mat4 model;
 
 void main() {
-	gl_Position = projection * model * vec4(a_pos, 1.0);
+	// Cover the circle plus a pixel for the anti-aliased edge.
+	local = a_corner * 2.0 * (a_radius + 1.0);
+	radius = a_radius;
+	thickness = a_thickness;
+	color = a_color;
+	gl_Position = projection * vec4(a_position + local, 0.0, 1.0);
 }
@@ -0,0 +1,8 @@
+#version 330 core
+out vec4 frag_color;
+
+in vec4 color;
+
+void main() {
+	frag_color = color;
+}
@@ -0,0 +1,6 @@
+// Coverage of a signed distance field with its edge at `edge`, blended
+// over `width` either side. Pass fwidth of the distance to fade across
+// one screen pixel and keep edges sharp at any size.
+float sdf_coverage(float distance, float edge, float width) {
+	return smoothstep(edge - width, edge + width, distance);
+}
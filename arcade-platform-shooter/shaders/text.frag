@@ -5,7 +5,11 @@ out vec4 frag_color;
 uniform sampler2D tex;
 uniform vec4 color;
 
+#include "sdf.glsl"
+
 void main() {
-	frag_color = vec4(1.0, 1.0, 1.0, texture(tex, uvs).r) * color;
+	// The atlas holds signed distances with the glyph edge at 0.5.
+	float distance = texture(tex, uvs).r;
+	float alpha = sdf_coverage(distance, 0.5, fwidth(distance));
+	frag_color = vec4(color.rgb, color.a * alpha);
 }
-
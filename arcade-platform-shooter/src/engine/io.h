@@ -5,6 +5,8 @@
 
 char *io_file_read(const char *path);
 int io_file_write(void *buffer, size_t size, const char *path);
+void *io_file_map(const char *path, size_t *size);
+void io_file_unmap(void *data, size_t size);
 
 #endif
 
@@ -1,8 +1,21 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include "../io.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 char *io_file_read(const char *path) {
 	FILE *fp = fopen(path, "r");
 
@@ -38,7 +51,7 @@ char *io_file_read(const char *path) {
 }
 
 int io_file_write(void *buffer, size_t size, const char *path) {
-	FILE *fp = fopen(path, "w");
+	FILE *fp = fopen(path, "wb");
 	if (!fp) {
 		printf("Cannot write file %s\n", path);
 		return 1;
@@ -57,3 +70,64 @@ int io_file_write(void *buffer, size_t size, const char *path) {
 	return 0;
 }
 
+
+// Maps a whole file read-only. The OS pages it in on demand, so large
+// assets skip the copy through a read buffer.
+void *io_file_map(const char *path, size_t *size) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		printf("Cannot map file %s\n", path);
+		return NULL;
+	}
+
+	LARGE_INTEGER length;
+	HANDLE mapping = NULL;
+	void *data = NULL;
+	if (GetFileSizeEx(file, &length) && length.QuadPart > 0)
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping) {
+		data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+
+	if (!data) {
+		printf("Cannot map file %s\n", path);
+		return NULL;
+	}
+
+	*size = (size_t)length.QuadPart;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		printf("Cannot map file %s\n", path);
+		return NULL;
+	}
+
+	struct stat info;
+	void *data = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0)
+		data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		printf("Cannot map file %s\n", path);
+		return NULL;
+	}
+
+	*size = info.st_size;
+#endif
+
+	printf("File mapped. %s\n", path);
+	return data;
+}
+
+void io_file_unmap(void *data, size_t size) {
+#ifdef _WIN32
+	(void)size;
+	UnmapViewOfFile(data);
+#else
+	munmap(data, size);
+#endif
+}
@@ -3,12 +3,38 @@
 Entity_State entity_state = {0};
 static Entity_State *state = &entity_state;
 
+// Fails to compile if the entity grows past one cache line.
+typedef char entity_fits_cache_line[sizeof(Entity) <= CACHE_LINE_SIZE ? 1 : -1];
+
 void entity_setup() {
-	state->entity_array = calloc(MAX_ENTITIES, sizeof(Entity));
+	state->entity_array = aligned_calloc(MAX_ENTITIES, sizeof(Entity), CACHE_LINE_SIZE);
+
+	for (u32 i = 0; i < MAX_ENTITY_TAGS; ++i) {
+		state->tag_member_array[i] = calloc(MAX_ENTITIES, sizeof(u32));
+		state->tag_index_array[i] = calloc(MAX_ENTITIES, sizeof(u16));
+	}
 }
 
-u32 entity_create(f32 x, f32 y, f32 collider_half_width, f32 collider_half_height, f32 sprite_width, f32 sprite_height,
-				  f32 sprite_offset_x, f32 sprite_offset_y, u32 layer_mask, u32 initial_animation_id) {
+u32 entity_type_create(f32 collider_half_width, f32 collider_half_height, f32 sprite_offset_x, f32 sprite_offset_y, u8 layer_mask,
+		       u8 is_kinematic, On_Collide_Function on_collide, On_Collide_Static_Function on_collide_static) {
+	u32 index = state->entity_type_array_count++;
+	if (index == MAX_ENTITY_TYPES)
+		error_and_exit(-1, "No more space for entity types.");
+
+	Entity_Type *type = &state->entity_type_array[index];
+	type->half_sizes[0] = collider_half_width;
+	type->half_sizes[1] = collider_half_height;
+	type->sprite_offset[0] = sprite_offset_x;
+	type->sprite_offset[1] = sprite_offset_y;
+	type->layer_mask = layer_mask;
+	type->is_kinematic = is_kinematic;
+	type->on_collide = on_collide;
+	type->on_collide_static = on_collide_static;
+
+	return index;
+}
+
+u32 entity_create(f32 x, f32 y, u32 type_id, u32 initial_animation_id) {
 	u32 index = MAX_ENTITIES;
 	for (u32 i = 0; i < MAX_ENTITIES; ++i) {
 		if (!state->entity_array[i].is_in_use) {
@@ -24,17 +50,15 @@ u32 entity_create(f32 x, f32 y, f32 collider_half_width, f32 collider_half_heigh
 	Entity *entity = &state->entity_array[index];
 	memset(entity, 0, sizeof(*entity));
 
-	entity->animation_id = 0xdeadbeef;
+	Entity_Type *type = &state->entity_type_array[type_id];
 	entity->aabb.position[0] = x;
 	entity->aabb.position[1] = y;
-	entity->aabb.half_sizes[0] = collider_half_width;
-	entity->aabb.half_sizes[1] = collider_half_height;
-	entity->sprite_size[0] = sprite_width;
-	entity->sprite_size[1] = sprite_height;
-	memcpy(entity->sprite_color, (vec4){1, 1, 1, 1}, sizeof(vec4)); 
-	entity->sprite_offset[0] = sprite_offset_x;
-	entity->sprite_offset[1] = sprite_offset_y;
-	entity->layer_mask = layer_mask;
+	entity->aabb.half_sizes[0] = type->half_sizes[0];
+	entity->aabb.half_sizes[1] = type->half_sizes[1];
+	entity->sprite_color = 0xffffffff;
+	entity->type_id = type_id;
+	entity->layer_mask = type->layer_mask;
+	entity->is_kinematic = type->is_kinematic;
 	entity->is_in_use = 1;
 	entity->animation_id = initial_animation_id;
 
@@ -44,6 +68,74 @@ u32 entity_create(f32 x, f32 y, f32 collider_half_width, f32 collider_half_heigh
 }
 
 void entity_destroy(u32 index) {
-	state->entity_array[index].is_in_use = 0;
+	Entity *entity = &state->entity_array[index];
+
+	// Leave every membership set so queries never see a free slot.
+	for (u32 tag = 0; entity->tags != 0; ++tag) {
+		if (entity->tags & (1u << tag))
+			entity_tag_remove(index, tag);
+	}
+
+	timer_cancel(entity->lifetime_timer);
+	entity->lifetime_timer = 0;
+	tween_cancel(index);
+	entity->is_in_use = 0;
 	--state->entity_array_count;
 }
+
+static void on_lifetime_expired(u32 index) {
+	entity_destroy(index);
+}
+
+void entity_lifetime_set(u32 index, f32 seconds) {
+	Entity *entity = &state->entity_array[index];
+	timer_cancel(entity->lifetime_timer);
+	entity->lifetime_timer = timer_schedule(seconds, on_lifetime_expired, index);
+}
+
+void entity_tag_add(u32 index, u32 tag) {
+	Entity *entity = &state->entity_array[index];
+	if (entity->tags & (1u << tag))
+		return;
+
+	u32 position = state->tag_member_count[tag]++;
+	state->tag_member_array[tag][position] = index;
+	state->tag_index_array[tag][index] = (u16)position;
+	entity->tags |= 1u << tag;
+}
+
+void entity_tag_remove(u32 index, u32 tag) {
+	Entity *entity = &state->entity_array[index];
+	if (!(entity->tags & (1u << tag)))
+		return;
+
+	// Swap the last member into the hole to keep the array dense.
+	u32 position = state->tag_index_array[tag][index];
+	u32 last_index = state->tag_member_array[tag][--state->tag_member_count[tag]];
+	state->tag_member_array[tag][position] = last_index;
+	state->tag_index_array[tag][last_index] = (u16)position;
+	entity->tags &= ~(1u << tag);
+}
+
+u8 entity_tag_has(u32 index, u32 tag) {
+	return (state->entity_array[index].tags & (1u << tag)) != 0;
+}
+
+u32 *entity_tag_query(u32 tag, u32 *count) {
+	*count = state->tag_member_count[tag];
+	return state->tag_member_array[tag];
+}
+
+// Ids are copied out so callers are free to add and remove tags while
+// handling the results.
+u32 entity_tag_query_radius(u32 tag, vec2 position, f32 radius, u32 *id_array, u32 id_array_max) {
+	u32 found = 0;
+	f32 sqr_radius = radius * radius;
+	for (u32 i = 0; i < state->tag_member_count[tag] && found < id_array_max; ++i) {
+		u32 index = state->tag_member_array[tag][i];
+		if (vec2_sqr_dist(state->entity_array[index].aabb.position, position) <= sqr_radius)
+			id_array[found++] = index;
+	}
+
+	return found;
+}
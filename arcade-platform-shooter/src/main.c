@@ -29,6 +29,25 @@ typedef enum collision_layer {
 	CL_MISC
 } Collision_Layer;
 
+typedef enum entity_tag {
+	ET_ENEMY,
+	ET_ENEMY_SMALL,
+	ET_ENEMY_LARGE,
+	ET_ANGRY,
+	ET_DYING,
+	ET_COUNT
+} Entity_Tag;
+
+// Draw order, back to front. Commands are sorted by layer before
+// anything else, so the order of render_* calls only matters within one.
+typedef enum render_layer {
+	RL_TERRAIN,
+	RL_EFFECTS,
+	RL_WORLD,
+	RL_DEBUG,
+	RL_HUD
+} Render_Layer;
+
 typedef struct game_state {
 	f32 time_now;
 	f32 time_last_frame;
@@ -41,27 +60,35 @@ typedef struct game_state {
 	// Time it took to calculate everything and render.
 	f32 frame_time;
 
-	f32 spawn_timer;
+	u32 spawn_timer;
 
 	Weapon_Type weapon_type;
 	Sprite_Animation* weapon_anim;
 	f32 weapon_offset_x;
 	f32 weapon_offset_flipped_x;
 	f32 weapon_offset_y;
-	f32 shoot_timer;
+	u32 shoot_timer;
 
 	vec2 rocket_explosion_position;
-	f32 rocket_explosion_timer;
+	u32 rocket_explosion_timer;
 
 	u32 rocket_id;
-	f32 rocket_smoke_timer;
+	u32 rocket_smoke_timer;
 
-	f32 weapon_kick;
+	// The kick velocity decays linearly so it is derived from the time
+	// left on this timer.
+	u32 weapon_kick_timer;
 
 	u32 score;
 	char score_string[10];
 
 	u8 should_quit;
+
+	// Headless runs simulate a fixed number of frames at a fixed step and
+	// write the last one out.
+	u8 is_headless;
+	u32 headless_frame_count;
+	const char *headless_output_path;
 } Game_State;
 
 static Game_State state = {0};
@@ -71,6 +98,7 @@ extern Render_State render_state;
 extern Physics_State physics_state;
 extern Input_State input_state;
 extern Sprite_State sprite_state;
+extern Projectile_State projectile_state;
 
 ////////////////////////////////////////////////////////////////////////
 // Constants.
@@ -82,11 +110,15 @@ static const f32 PLAYER_MOVEMENT_SPEED = 150;
 static const f32 EXPLOSION_RADIUS = 60;
 static const f32 EXPLOSION_TIME = 0.25;
 static const f32 PLAYER_JUMP_VELOCITY = 600;
+static const f32 WEAPON_KICK_DECAY = 1000;
+static const f32 SMOKE_FADE_TIME = 0.33;
 static const f32 BOX_SPAWN_REGIONS[][4] = {
 	{32, HEIGHT - 7 * 32, 6 * 32, 6 * 32},
 	{8 * 32, HEIGHT - 7 * 32, 6 * 32, 6 * 32}
 };
 static const u32 SPAWN_REGION_COUNT = 2;
+// How far a sprite can reach past its collider, rotated.
+static const f32 CULL_MARGIN = SPATIAL_GRID_CELL_SIZE;
 
 static const f32 SPEED_ENEMY_LARGE = 60;
 static const f32 SPEED_ENEMY_SMALL = 100;
@@ -131,6 +163,14 @@ static u32 ANIM_FIRE;
 
 static u32 SMOKE_IDLE_ANIM;
 
+static u32 ENTITY_TYPE_PLAYER;
+static u32 ENTITY_TYPE_ENEMY_SMALL;
+static u32 ENTITY_TYPE_ENEMY_LARGE;
+static u32 ENTITY_TYPE_ROCKET;
+static u32 ENTITY_TYPE_BOX;
+static u32 ENTITY_TYPE_SMOKE;
+static u32 ENTITY_TYPE_FIRE;
+
 static Mix_Music *TITLE_THEME;
 static Mix_Music *STAGE_1_THEME;
 
@@ -154,12 +194,12 @@ static void on_fire_trigger(Collision collision) {
 	Entity *self = &entity_state.entity_array[collision.self_id];
 
 	// Make sure entities which are falling off the screen don't trigger this.
-	if (self->time_to_live > 0)
+	if (entity_tag_has(collision.self_id, ET_DYING))
 		return;
 
 	if (collision.self_id == 0) {
 		reset();
-	} else if (self->layer_mask == CL_ENEMY) {
+	} else if (entity_tag_has(collision.self_id, ET_ENEMY)) {
 		bool is_left_side = rand() % 100 >= 50;
 		f32 spawn_x = is_left_side ? 0 - 64 : WIDTH + 64;
 
@@ -174,12 +214,14 @@ static void on_fire_trigger(Collision collision) {
 			self->is_flipped = true;
 		}
 		
-		if (self->animation_id == SMALL_ENEMY_WALK_ANIM) {
-			self->animation_id = SMALL_ANGRY_ENEMY_WALK_ANIM;
-			self->velocity[0] *= 1.5;
-		} else if (self->animation_id == LARGE_ENEMY_WALK_ANIM) {
-			self->animation_id = LARGE_ANGRY_ENEMY_WALK_ANIM;
+		if (!entity_tag_has(collision.self_id, ET_ANGRY)) {
+			entity_tag_add(collision.self_id, ET_ANGRY);
 			self->velocity[0] *= 1.5;
+			if (entity_tag_has(collision.self_id, ET_ENEMY_LARGE)) {
+				self->animation_id = LARGE_ANGRY_ENEMY_WALK_ANIM;
+			} else {
+				self->animation_id = SMALL_ANGRY_ENEMY_WALK_ANIM;
+			}
 		}
 	}
 }
@@ -193,9 +235,11 @@ static void on_enemy_collide(Collision collision) {
 
 static void kill_enemy(u32 id) {
 	Entity *enemy = &entity_state.entity_array[id];
-	enemy->time_to_live = 3;
+	entity_lifetime_set(id, 3);
 	enemy->layer_mask = 5;
 	enemy->velocity[1] = 100;
+	entity_tag_remove(id, ET_ENEMY);
+	entity_tag_add(id, ET_DYING);
 	audio_sound_play(ENEMY_DEATH_SOUND);
 }
 
@@ -204,7 +248,7 @@ static void on_enemy_hit(Entity *enemy, u32 id) {
 		kill_enemy(id);
 	audio_sound_play(HURT_SOUND);
 
-	if (enemy->animation_id == LARGE_ENEMY_WALK_ANIM || enemy->animation_id == LARGE_ANGRY_ENEMY_WALK_ANIM) {
+	if (entity_tag_has(id, ET_ENEMY_LARGE)) {
 		enemy->desired_velocity[0] = SPEED_ENEMY_LARGE * fsign(enemy->velocity[0]);
 		enemy->acceleration[0] = SPEED_ENEMY_LARGE * fsign(enemy->velocity[0]) * 0.1;
 		enemy->velocity[0] = 0;
@@ -213,43 +257,30 @@ static void on_enemy_hit(Entity *enemy, u32 id) {
 		enemy->acceleration[0] = SPEED_ENEMY_SMALL * fsign(enemy->velocity[0]) * 0.1;
 		enemy->velocity[0] = 0;
 	}
-
-	//enemy->desired_sprite_color[1] = 0;
-	//enemy->sprite_color_delta[1] = -0.35;
-	//enemy->desired_sprite_color[2] = 0;
-	//enemy->sprite_color_delta[2] = -0.35;
 }
 
-static void on_bullet_collide(Collision collision) {
-	entity_destroy(collision.self_id);
-	Entity *enemy = &entity_state.entity_array[collision.other_id];
-	--enemy->health;
-
-	on_enemy_hit(enemy, collision.other_id);
-}
+static void on_projectile_hit(Projectile_Hit *projectile_hit) {
+	if (projectile_hit->is_static) {
+		audio_sound_play(BULLET_HIT_WALL_SOUND);
+		return;
+	}
 
-static void on_bullet_collide_static(Collision collision) {
-	entity_destroy(collision.self_id);
-	audio_sound_play(BULLET_HIT_WALL_SOUND);
-}
+	// Several bullets can reach the same enemy in one tick. Only the ones
+	// before it died count.
+	if (!entity_tag_has(projectile_hit->target_id, ET_ENEMY))
+		return;
 
-static void on_bullet_large_collide(Collision collision) {
-	entity_destroy(collision.self_id);
-	Entity *enemy = &entity_state.entity_array[collision.other_id];
-	enemy->health -= 2;
+	Entity *enemy = &entity_state.entity_array[projectile_hit->target_id];
+	enemy->health -= projectile_hit->damage;
 
-	on_enemy_hit(enemy, collision.other_id);
+	on_enemy_hit(enemy, projectile_hit->target_id);
 }
 
 static void rocket_damage(f32 pct) {
-	for (u32 i = 1; i < MAX_ENTITIES; ++i) {
-		Entity *entity = &entity_state.entity_array[i];
-		if ((entity->layer_mask & CL_ENEMY) > 0 && !entity->is_kinematic) {
-			f32 distance = vec2_sqr_dist(entity->aabb.position, state.rocket_explosion_position);
-			if (distance <= EXPLOSION_RADIUS * EXPLOSION_RADIUS * pct) {
-				kill_enemy(i);
-			}
-		}
+	u32 id_array[MAX_ENTITIES];
+	u32 count = entity_tag_query_radius(ET_ENEMY, state.rocket_explosion_position, EXPLOSION_RADIUS * sqrtf(pct), id_array, MAX_ENTITIES);
+	for (u32 i = 0; i < count; ++i) {
+		kill_enemy(id_array[i]);
 	}
 }
 
@@ -257,9 +288,10 @@ static void on_rocket_collide(Collision collision) {
 	entity_destroy(collision.self_id);
 	state.rocket_explosion_position[0] = collision.hit.position[0];
 	state.rocket_explosion_position[1] = collision.hit.position[1];
-	state.rocket_explosion_timer = EXPLOSION_TIME;
+	state.rocket_explosion_timer = timer_schedule(EXPLOSION_TIME, NULL, 0);
 	render_screen_shake_add(EXPLOSION_TIME, 1.5);
 	state.rocket_id = 0;
+	timer_cancel(state.rocket_smoke_timer);
 	audio_sound_play(EXPLOSION_SOUND);
 }
 
@@ -274,49 +306,56 @@ static void on_enemy_collide_static(Collision collision) {
 		self->acceleration[0] = -self->acceleration[0];
 	} else {
 		// If enemy is large, shake the screen a bit, but only once.
-		if ((self->animation_id == LARGE_ENEMY_WALK_ANIM || self->animation_id == LARGE_ANGRY_ENEMY_WALK_ANIM) && self->last_velocity[1] != 0) {
+		if (entity_tag_has(collision.self_id, ET_ENEMY_LARGE) && self->was_airborne) {
 			render_screen_shake_add(EXPLOSION_TIME, 0.2);
 		}
 	}
 
 }
 
-static void spawn_projectile(Projectile_Type type, f32 x, f32 y, f32 velocity_x, f32 velocity_y, f32 time_to_live, On_Collide_Function on_collide, On_Collide_Static_Function on_collide_static) {
+static void spawn_rocket_smoke(u32 rocket_id) {
+	Entity *rocket = &entity_state.entity_array[rocket_id];
+	if (rocket_id != state.rocket_id || !rocket->is_in_use)
+		return;
+
+	u32 smoke_id = entity_create(rocket->aabb.position[0], rocket->aabb.position[1], ENTITY_TYPE_SMOKE, SMOKE_IDLE_ANIM);
+	Entity *smoke = &entity_state.entity_array[smoke_id];
+	smoke->rotation = frandr(0, 2 * PI);
+	smoke->velocity[1] = frandr(-10, 10);
+	smoke->velocity[0] = frandr(-10, 10);
+	tween_color(smoke_id, (vec4){1, 1, 1, 0}, SMOKE_FADE_TIME, TE_LINEAR);
+	entity_lifetime_set(smoke_id, frandr(0.15, 0.6));
+
+	state.rocket_smoke_timer = timer_schedule(0.05, spawn_rocket_smoke, rocket_id);
+}
+
+static void spawn_projectile(Projectile_Type type, f32 x, f32 y, f32 velocity_x, f32 velocity_y, f32 time_to_live) {
 	Entity *player = entity_state.entity_array;
-	u32 projectile_id;
+	f32 direction = player->is_flipped ? -1 : 1;
 	switch (type) {
 	case PT_BULLET: {
-		projectile_id = entity_create(x, y, 1.5, 1.5, 3, 3, -8, -8, CL_BULLET, BULLET_IDLE_ANIM);
+		projectile_spawn(x, y, velocity_x * direction, velocity_y, time_to_live, 1.5, 1, 0, CL_BULLET, BULLET_IDLE_ANIM);
 	} break;
 	case PT_BULLET_LARGE: {
-		projectile_id = entity_create(x, y, 2, 2, 4, 4, -8, -8, CL_BULLET, BULLET_LARGE_IDLE_ANIM);
+		projectile_spawn(x, y, velocity_x * direction, velocity_y, time_to_live, 2, 2, 0, CL_BULLET, BULLET_LARGE_IDLE_ANIM);
 	} break;
+	// The rocket accelerates, trails smoke and explodes, so it stays a
+	// full entity.
 	case PT_ROCKET: {
-		projectile_id = entity_create(x, y, 4, 2.5, 8, 5, -8, -8, CL_BULLET, ROCKET_IDLE_ANIM);
+		u32 projectile_id = entity_create(x, y, ENTITY_TYPE_ROCKET, ROCKET_IDLE_ANIM);
 		Entity *projectile = &entity_state.entity_array[projectile_id];
 		projectile->acceleration[0] = player->is_flipped ? -velocity_x * 0.05 : velocity_x * 0.05;
 		projectile->desired_velocity[0] = player->is_flipped ? -velocity_x : velocity_x;
 		projectile->velocity[0] = 0;
-		projectile->is_kinematic = 1;
-		projectile->on_collide = on_collide;
-		projectile->on_collide_static = on_collide_static;
-		projectile->time_to_live = time_to_live;
 		projectile->is_flipped = player->is_flipped;
+		entity_lifetime_set(projectile_id, time_to_live);
 
 		state.rocket_id = projectile_id;
-		state.rocket_smoke_timer = 0.01;
-		return;
+		timer_cancel(state.rocket_smoke_timer);
+		state.rocket_smoke_timer = timer_schedule(0.01, spawn_rocket_smoke, projectile_id);
 	} break;
 	case PT_COUNT: break;
 	}
-	Entity *projectile = &entity_state.entity_array[projectile_id];
-	projectile->is_kinematic = 1;
-	projectile->velocity[0] = player->is_flipped ? -velocity_x : velocity_x;
-	projectile->velocity[1] = velocity_y;
-	projectile->on_collide = on_collide;
-	projectile->on_collide_static = on_collide_static;
-	projectile->time_to_live = time_to_live;
-	projectile->is_flipped = player->is_flipped;
 }
 
 static void on_box_collide(Collision collision) {
@@ -375,6 +414,7 @@ static void on_box_collide(Collision collision) {
 
 		++state.score;
 		sprintf(state.score_string, "%d", state.score);
+		render_layer_dirty(RL_HUD);
 
 		spawn_box();
 		audio_sound_play(BOX_SOUND);
@@ -385,14 +425,47 @@ static void spawn_box() {
 	const f32 *region = &BOX_SPAWN_REGIONS[rand() % SPAWN_REGION_COUNT][0];
 	f32 x = frandr(region[0], region[0] + region[2]);
 	f32 y = frandr(region[1], region[1] + region[3]);
-	u32 id = entity_create(x, y, 8, 8, 8, 8, -8, -8, CL_BOX, BOX_IDLE_ANIM);
-	Entity *entity = &entity_state.entity_array[id];
-	entity->on_collide = on_box_collide;
+	entity_create(x, y, ENTITY_TYPE_BOX, BOX_IDLE_ANIM);
+}
+
+static void spawn_enemy(u32 id) {
+	(void)id;
+	state.spawn_timer = timer_schedule(frandr(2, 4), spawn_enemy, 0);
+
+	u8 health = HEALTH_ENEMY_SMALL;
+	u32 enemy_id = 0;
+	f32 speed = SPEED_ENEMY_SMALL;
+
+	bool is_small_entity = rand() % 100 > 18;
+	bool is_left_side = rand() % 100 >= 50;
+
+	f32 spawn_x = is_left_side ? 0 - 64 : WIDTH + 64;
+
+	if (is_small_entity) {
+		enemy_id = entity_create(spawn_x, HEIGHT, ENTITY_TYPE_ENEMY_SMALL, SMALL_ENEMY_WALK_ANIM);
+		entity_tag_add(enemy_id, ET_ENEMY_SMALL);
+	} else {
+		enemy_id = entity_create(spawn_x, HEIGHT, ENTITY_TYPE_ENEMY_LARGE, LARGE_ENEMY_WALK_ANIM);
+		entity_tag_add(enemy_id, ET_ENEMY_LARGE);
+		health = HEALTH_ENEMY_LARGE;
+		speed = SPEED_ENEMY_LARGE;
+	}
+	entity_tag_add(enemy_id, ET_ENEMY);
+
+	Entity *enemy = &entity_state.entity_array[enemy_id];
+	enemy->health = health;
+	enemy->is_flipped = !is_left_side;
+	enemy->velocity[0] = is_left_side ? speed : -speed;
 }
 
 static void reset() {
+	projectile_clear();
+
 	// Destroy all entities besides the player.
-	memset(&entity_state.entity_array[1], 0, (MAX_ENTITIES - 1) * sizeof(Entity));
+	for (u32 i = 1; i < MAX_ENTITIES; ++i) {
+		if (entity_state.entity_array[i].is_in_use)
+			entity_destroy(i);
+	}
 
 	// Reset the player.
 	Entity *player = &entity_state.entity_array[0];
@@ -414,15 +487,14 @@ static void reset() {
 
 	state.score = 0;
 	sprintf(state.score_string, "%d", state.score);
+	render_layer_dirty(RL_HUD);
 
 	audio_music_play(STAGE_1_THEME);
 	Mix_VolumeMusic(MIX_MAX_VOLUME/2);
 
 	spawn_box();
 
-	u32 fire_id = entity_create(WIDTH * 0.5, 0, 16, 32, 32, 64, -16, -32, CL_MISC, ANIM_FIRE);
-	Entity *fire = &entity_state.entity_array[fire_id];
-	fire->is_kinematic = true;
+	entity_create(WIDTH * 0.5, 0, ENTITY_TYPE_FIRE, ANIM_FIRE);
 }
 
 // Fix double main in Windows.
@@ -430,12 +502,36 @@ static void reset() {
 #undef main
 #endif
 
-int main(void) {
-	srand(time(NULL));
+// Usage: game [--headless <frames> <output.ppm>]
+static int id_compare(const void *a, const void *b) {
+	u32 x = *(const u32 *)a;
+	u32 y = *(const u32 *)b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+	if (argc >= 2 && strcmp(argv[1], "--headless") == 0) {
+		state.is_headless = 1;
+		state.headless_frame_count = argc >= 3 ? (u32)atoi(argv[2]) : 60;
+		state.headless_output_path = argc >= 4 ? argv[3] : "frame.ppm";
+		if (state.headless_frame_count == 0)
+			state.headless_frame_count = 1;
+
+		// Same frames every run, and no audio device required.
+		srand(0);
+		SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+	} else {
+		srand(time(NULL));
+	}
 
 	// Setup states.
 	entity_setup();
-	render_setup();
+	timer_setup();
+	tween_setup();
+	projectile_setup();
+	render_setup(state.is_headless);
+	render_debug_set(DEBUG);
+	profile_setup();
 	physics_setup();
 	input_setup();
 	audio_setup();
@@ -447,16 +543,24 @@ int main(void) {
 	physics_state.mask_array[3] = 15;
 	physics_state.mask_array[4] = 13;
 
-	// Setup textures.
-	TERRAIN_TEXTURE = render_texture_create("./assets/map.png");
-	SPRITES_TEXTURE = render_texture_create("./assets/sprites.png");
-	PLAYER_TEXTURE = render_texture_create("./assets/player.png");
-	ENEMY_LARGE_TEXTURE = render_texture_create("./assets/enemy_large.png");
-	ENEMY_SMALL_TEXTURE = render_texture_create("./assets/enemy_small.png");
-	TEXTURE_PROPS = render_texture_create("./assets/props_16x16.png");
-	TEXTURE_WEAPONS = render_texture_create("./assets/weapons.png");
-	TEXTURE_SMOKE = render_texture_create("./assets/smoke.png");
-	TEXTURE_FIRE = render_texture_create("./assets/fire.png");
+	// Setup textures. They share one atlas so the whole scene can be
+	// drawn without switching textures. It is baked by `make textures`,
+	// which lists the images in this order.
+	Texture texture_array[9];
+	render_atlas_load(ATLAS_FILE_PATH, 9, texture_array);
+	TERRAIN_TEXTURE = texture_array[0];
+	SPRITES_TEXTURE = texture_array[1];
+	PLAYER_TEXTURE = texture_array[2];
+	ENEMY_LARGE_TEXTURE = texture_array[3];
+	ENEMY_SMALL_TEXTURE = texture_array[4];
+	TEXTURE_PROPS = texture_array[5];
+	TEXTURE_WEAPONS = texture_array[6];
+	TEXTURE_SMOKE = texture_array[7];
+	TEXTURE_FIRE = texture_array[8];
+
+	// The terrain never changes and the HUD only when the score does.
+	render_layer_cache(RL_TERRAIN, 1);
+	render_layer_cache(RL_HUD, 0);
 
 	// Setup sounds.
 	audio_sound_load(&JUMP_SOUND, "./assets/jump.wav");
@@ -503,8 +607,17 @@ int main(void) {
 	SMOKE_IDLE_ANIM	= sprite_animation_create(SPRITE_SHEET_SMOKE, 1, (u8[]){0}, (u8[]){2}, (f32[]){0.15}, 1);
 	ANIM_FIRE = sprite_animation_create(SPRITE_SHEET_FIRE, 7, (u8[]){0, 0, 0, 0, 0, 0, 0}, (u8[]){0, 1, 2, 3, 4, 5, 6}, (f32[]){0.1, 0.1, 0.1, 0.1, 0.1, 0.1}, 1);
 
+	// Setup entity types.
+	ENTITY_TYPE_PLAYER = entity_type_create(6, 6, -12, -6, CL_PLAYER, 0, NULL, NULL);
+	ENTITY_TYPE_ENEMY_SMALL = entity_type_create(8, 8, -12, -8, CL_ENEMY, 0, on_enemy_collide, on_enemy_collide_static);
+	ENTITY_TYPE_ENEMY_LARGE = entity_type_create(12, 12, -18, -12, CL_ENEMY, 0, on_enemy_collide, on_enemy_collide_static);
+	ENTITY_TYPE_ROCKET = entity_type_create(4, 2.5, -8, -8, CL_BULLET, 1, on_rocket_collide, on_rocket_collide);
+	ENTITY_TYPE_BOX = entity_type_create(8, 8, -8, -8, CL_BOX, 0, on_box_collide, NULL);
+	ENTITY_TYPE_SMOKE = entity_type_create(0, 0, -12, -12, CL_MISC, 1, NULL, NULL);
+	ENTITY_TYPE_FIRE = entity_type_create(16, 32, -16, -32, CL_MISC, 1, NULL, NULL);
+
 	// Setup player.
-	entity_create(PLAYER_SPAWN_X, PLAYER_SPAWN_Y, 6, 6, 24, 24, -12, -6, CL_PLAYER, PLAYER_IDLE_ANIM);
+	entity_create(PLAYER_SPAWN_X, PLAYER_SPAWN_Y, ENTITY_TYPE_PLAYER, PLAYER_IDLE_ANIM);
 
 	// Setup colliders.
 	{
@@ -542,14 +655,20 @@ int main(void) {
 
 	reset();
 
+	state.spawn_timer = timer_schedule(0, spawn_enemy, 0);
+
 	state.previous_time = (f32)SDL_GetTicks();
 	
 	while (!state.should_quit) {
 		state.time_now = (f32)SDL_GetTicks();
 		state.delta_time = (state.time_now - state.time_last_frame) / 1000;
+		if (state.is_headless)
+			state.delta_time = FRAME_DELAY / 1000;
 		state.time_last_frame = state.time_now;
 		state.frame_count++;
 
+		profile_begin(PS_FRAME);
+
 		if (state.time_now - state.previous_time >= 1000) {
 			state.frame_rate = state.frame_count;
 			state.frame_count = 0;
@@ -559,11 +678,20 @@ int main(void) {
 		/////////////////////////////////////////////////////////////////////
 		// Handle input.
 		/////////////////////////////////////////////////////////////////////
+		profile_begin(PS_INPUT);
 		SDL_Event event;
 		while (SDL_PollEvent(&event)) {
 			switch (event.type) {
 			case SDL_QUIT:
 				exit(0);
+			case SDL_KEYDOWN:
+				if (event.key.keysym.scancode == SDL_SCANCODE_F11 && !event.key.repeat)
+					render_fullscreen_toggle();
+				if (event.key.keysym.scancode == SDL_SCANCODE_F3 && !event.key.repeat)
+					profile_toggle();
+				if (event.key.keysym.scancode == SDL_SCANCODE_F2 && !event.key.repeat)
+					render_debug_toggle();
+				break;
 			default:
 				break;
 			}
@@ -574,8 +702,6 @@ int main(void) {
 		f32 horizontal_velocity = 0;
 		f32 vertical_velocity = player->velocity[1];
 
-		state.weapon_kick -= 1000 * state.delta_time;
-
 		const u8 *keyboard_state = SDL_GetKeyboardState(NULL);
 
 		if (keyboard_state[SDL_SCANCODE_ESCAPE]) {
@@ -607,40 +733,40 @@ int main(void) {
 		}
 
 		if (keyboard_state[SDL_SCANCODE_E]) {
-			if (state.shoot_timer <= 0) {
+			if (!timer_is_active(state.shoot_timer)) {
 				switch (state.weapon_type) {
 				case WT_MACHINE_GUN: {
 					audio_sound_play(MACHINE_GUN_SOUND);
-					state.shoot_timer = 0.05;
-					spawn_projectile(PT_BULLET, player->aabb.position[0], player->aabb.position[1] + 4, 400, frandr(-15, 15), 9, on_bullet_collide, on_bullet_collide_static);
-					state.weapon_kick = 100;
+					state.shoot_timer = timer_schedule(0.05, NULL, 0);
+					spawn_projectile(PT_BULLET, player->aabb.position[0], player->aabb.position[1] + 4, 400, frandr(-15, 15), 9);
+					state.weapon_kick_timer = timer_schedule(100 / WEAPON_KICK_DECAY, NULL, 0);
 					render_screen_shake_add(0.05, 0.15);
 				} break;
 				case WT_SHOTGUN: {
 					audio_sound_play(SHOTGUN_SOUND);
-					state.shoot_timer = 0.75;
+					state.shoot_timer = timer_schedule(0.75, NULL, 0);
 					render_screen_shake_add(0.1, 0.75);
 					for (u32 i = 0; i < 15; ++i) {
 						f32 vy = frandr(-35, 35);
 						f32 vx = frandr(280, 350);
-						spawn_projectile(PT_BULLET, player->aabb.position[0] + (player->is_flipped ? -8 : 8), player->aabb.position[1], vx, vy, 0.25, on_bullet_collide, on_bullet_collide_static);
+						spawn_projectile(PT_BULLET, player->aabb.position[0] + (player->is_flipped ? -8 : 8), player->aabb.position[1], vx, vy, 0.25);
 					}
 				} break;
 				case WT_ROCKET_LAUNCHER: {
 					audio_sound_play(ROCKET_LAUNCHED_SOUND);
-					state.shoot_timer = 1.25;
-					spawn_projectile(PT_ROCKET, player->aabb.position[0], player->aabb.position[1], 200, 0, 9, on_rocket_collide, on_rocket_collide);
+					state.shoot_timer = timer_schedule(1.25, NULL, 0);
+					spawn_projectile(PT_ROCKET, player->aabb.position[0], player->aabb.position[1], 200, 0, 9);
 				} break;
 				case WT_PISTOL: {
 					audio_sound_play(SHOOT_SOUND);
-					state.shoot_timer = 0.25;
-					spawn_projectile(PT_BULLET, player->aabb.position[0], player->aabb.position[1] + 5, 300, 0, 9, on_bullet_collide, on_bullet_collide_static);
+					state.shoot_timer = timer_schedule(0.25, NULL, 0);
+					spawn_projectile(PT_BULLET, player->aabb.position[0], player->aabb.position[1] + 5, 300, 0, 9);
 					render_screen_shake_add(0.05, 0.03);
 				} break;
 				case WT_REVOLVER: {
 					audio_sound_play(REVOLVER_SOUND);
-					state.shoot_timer = 0.55;
-					spawn_projectile(PT_BULLET_LARGE, player->aabb.position[0], player->aabb.position[1] + 5, 300, 0, 9, on_bullet_large_collide, on_bullet_collide_static);
+					state.shoot_timer = timer_schedule(0.55, NULL, 0);
+					spawn_projectile(PT_BULLET_LARGE, player->aabb.position[0], player->aabb.position[1] + 5, 300, 0, 9);
 					render_screen_shake_add(0.1, 0.75);
 				} break;
 				case WT_COUNT: break;
@@ -648,8 +774,9 @@ int main(void) {
 			}
 		}
 
-		if (state.weapon_kick >= 0) {
-			horizontal_velocity = player->is_flipped ? state.weapon_kick : -state.weapon_kick;
+		if (timer_is_active(state.weapon_kick_timer)) {
+			f32 weapon_kick = timer_remaining(state.weapon_kick_timer) * WEAPON_KICK_DECAY;
+			horizontal_velocity = player->is_flipped ? weapon_kick : -weapon_kick;
 		}
 
 		player->velocity[0] = horizontal_velocity;
@@ -665,120 +792,109 @@ int main(void) {
 			player->animation_id = PLAYER_WALK_ANIM;
 		}
 		
+		profile_end();
+
 		/////////////////////////////////////////////////////////////////////
 		// Update state.
 		/////////////////////////////////////////////////////////////////////
+		profile_begin(PS_SIMULATE);
 
-		state.shoot_timer -= state.delta_time;
+		// Fires expired timers: lifetimes, cooldowns and spawns.
+		timer_tick(state.delta_time);
 
-		// Spawn enemy.
-		state.spawn_timer -= state.delta_time;
-		if (state.spawn_timer < 0) {
-			state.spawn_timer = frandr(2, 4);
-			u8 health = HEALTH_ENEMY_SMALL;
-			u32 enemy_id = 0;
-			f32 speed = SPEED_ENEMY_SMALL;
+		tween_tick(state.delta_time);
 
-			bool is_small_entity = rand() % 100 > 18;
-			bool is_left_side = rand() % 100 >= 50;
-
-			f32 spawn_x = is_left_side ? 0 - 64 : WIDTH + 64;
-
-			if (is_small_entity) {
-				enemy_id = entity_create(spawn_x, HEIGHT, 8, 8, 24, 24, -12, -8, CL_ENEMY, SMALL_ENEMY_WALK_ANIM);
-			} else {
-				enemy_id = entity_create(spawn_x, HEIGHT, 12, 12, 40, 40, -18, -12, CL_ENEMY, LARGE_ENEMY_WALK_ANIM);
-				health = HEALTH_ENEMY_LARGE;
-				speed = SPEED_ENEMY_LARGE;
-			}
-
-			Entity *enemy = &entity_state.entity_array[enemy_id];
-			enemy->health = health;
-			enemy->is_flipped = !is_left_side;
-			enemy->velocity[0] = is_left_side ? speed : -speed;
-			enemy->on_collide_static = on_enemy_collide_static;
-			enemy->on_collide = on_enemy_collide;
-			enemy->time_to_live = 0;
+		// Spin enemies as they fall off the screen.
+		u32 dying_count;
+		u32 *dying_array = entity_tag_query(ET_DYING, &dying_count);
+		for (u32 i = 0; i < dying_count; ++i) {
+			entity_state.entity_array[dying_array[i]].rotation += state.delta_time * 10;
 		}
+		profile_end();
 
 		/////////////////////////////////////////////////////////////////////
 		// Render.
 		/////////////////////////////////////////////////////////////////////
 
-		// Clear screen, etc.
-		glClearColor(0.0, 0.7, 0.9, 1);
-		glClear(GL_COLOR_BUFFER_BIT);
-
-		glUseProgram(render_state.shader);
+		// Waits here if the render thread is still on the frame before.
+		profile_begin(PS_WAIT);
+		render_begin();
+		profile_end();
 
 		// Render terrain.
-		// It's rendered before physics is updated as physics may have some debug rendering.
-		render_sprite(TERRAIN_TEXTURE, NULL, (vec3){0, -18, 0}, NULL, 0, (vec4){1, 1, 1, 1}, 0);
+		profile_begin(PS_SUBMIT);
+		if (render_layer_set(RL_TERRAIN))
+			render_sprite(TERRAIN_TEXTURE, NULL, (vec3){0, -18, 0}, NULL, 0, (vec4){1, 1, 1, 1}, 0);
+		profile_end();
+
 		// Update physics.
+		profile_begin(PS_SIMULATE);
 		physics_tick(state.delta_time, entity_state.entity_array);
 		physics_cleanup();
 
+		projectile_tick(state.delta_time);
+		for (u32 i = 0; i < projectile_state.hit_array_count; ++i) {
+			on_projectile_hit(&projectile_state.hit_array[i]);
+		}
+
 		render_screen_shake(state.delta_time);
+		profile_end();
 
 		// Render explosion.
-		if (state.rocket_explosion_timer > 0) {
-			glUseProgram(render_state.circle_shader);
-			f32 pct = 1 - state.rocket_explosion_timer / EXPLOSION_TIME;
+		profile_begin(PS_SUBMIT);
+		render_layer_set(RL_EFFECTS);
+		if (timer_is_active(state.rocket_explosion_timer)) {
+			f32 pct = 1 - timer_remaining(state.rocket_explosion_timer) / EXPLOSION_TIME;
 			render_circle(state.rocket_explosion_position[0],
 				      state.rocket_explosion_position[1],
 				      EXPLOSION_RADIUS * pct, (vec4){1, 1, 1, 1});
-			state.rocket_explosion_timer -= state.delta_time;
 			rocket_damage(pct);
 		}
 
-		glUseProgram(render_state.shader);
+		render_layer_set(RL_WORLD);
 
-		for (u32 i = 0; i < MAX_ENTITIES; ++i) {
-			Entity *entity = &entity_state.entity_array[i];
+		// Only entities in the grid cells around the view are looked at, so
+		// the cost follows what's on screen rather than the whole level.
+		AABB view = render_view_get();
+		AABB view_cells = view;
+		view_cells.half_sizes[0] += CULL_MARGIN;
+		view_cells.half_sizes[1] += CULL_MARGIN;
+
+		// Sorted so overlapping sprites keep drawing in the same order.
+		u32 visible_array[MAX_ENTITIES];
+		u32 visible_count = spatial_grid_query(&physics_state.entity_grid, view_cells, visible_array, MAX_ENTITIES);
+		qsort(visible_array, visible_count, sizeof(u32), id_compare);
+
+		for (u32 i = 0; i < visible_count; ++i) {
+			Entity *entity = &entity_state.entity_array[visible_array[i]];
 			if (!entity->is_in_use) {
 				continue;
 			}
 
-			if (entity->time_to_live > 0) {
-				if (!entity->is_kinematic)
-					entity->rotation += state.delta_time * 10;
-				entity->time_to_live -= state.delta_time;
-				if (entity->time_to_live <= 0) {
-					entity_destroy(i);
-				}
-			}
+			Entity_Type *type = &entity_state.entity_type_array[entity->type_id];
+			vec3 position = {entity->aabb.position[0] + type->sprite_offset[0],
+					 entity->aabb.position[1] + type->sprite_offset[1], 0};
 
-			// Update sprite color.
-			for (u32 j = 0; j < 4; ++j) {
-				entity->sprite_color[j] += entity->sprite_color_delta[j];
-				if (entity->sprite_color_delta[j] != 0 && fabs(entity->sprite_color[j]) < fabs(entity->desired_sprite_color[j])) {
-					entity->sprite_color[j] = entity->desired_sprite_color[j];
-				}
-			}
+			Sprite_Animation *sa = &sprite_state.sprite_animation_array[entity->animation_id];
+			Sprite_Sheet *sheet = &sprite_state.sprite_sheet_array[sa->sprite_sheet_id];
+			if (!render_rect_is_visible(view, position[0], position[1], sheet->frame_width, sheet->frame_height))
+				continue;
 
-			vec3 position = {entity->aabb.position[0] + entity->sprite_offset[0],
-					 entity->aabb.position[1] + entity->sprite_offset[1], 0};
+			vec4 color;
+			color_unpack(entity->sprite_color, color);
 
-			Sprite_Animation *sa = &sprite_state.sprite_animation_array[entity->animation_id];
 			render_sprite_sheet_frame(
-				sprite_state.sprite_sheet_array[sa->sprite_sheet_id],
+				*sheet,
 				sa->row_coordinate_array[sa->current_frame],
 				sa->column_coordinate_array[sa->current_frame],
 				position,
 				entity->rotation,
-				entity->sprite_color,
+				color,
 				entity->is_flipped);
-
-
-			// Render entity colliders.
-#if DEBUG
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-			render_aabb(entity->aabb, (vec4){0, 1, 0, 1});
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-#endif
-
 		}
 		
+		projectile_render();
+
 		// Render player's gun.
 		render_sprite_sheet_frame(
 			sprite_state.sprite_sheet_array[state.weapon_anim->sprite_sheet_id],
@@ -790,63 +906,77 @@ int main(void) {
 			player->is_flipped
 		);
 
-		// Spawn rocket smoke.
-		if (state.rocket_id > 0) {
-			Entity *rocket = &entity_state.entity_array[state.rocket_id];
-			if (state.rocket_smoke_timer >= 0)
-				state.rocket_smoke_timer -= state.delta_time;
-
-			if (rocket->is_in_use && state.rocket_smoke_timer < 0) {
-				u32 smoke_id = entity_create(rocket->aabb.position[0], rocket->aabb.position[1], 0, 0, 24, 24, -12, -12, CL_MISC, SMOKE_IDLE_ANIM);
-				Entity *smoke = &entity_state.entity_array[smoke_id];
-				state.rocket_smoke_timer = 0.05;
-				smoke->rotation = frandr(0, 2 * PI);
-				smoke->is_kinematic = 1;
-				smoke->time_to_live = frandr(0.15, 0.6);
-				smoke->velocity[1] = frandr(-10, 10);
-				smoke->velocity[0] = frandr(-10, 10);
-				smoke->sprite_color_delta[3] = -0.05;
-				smoke->desired_sprite_color[3] = 0;
-			}
-		}
+		profile_end();
 
 		// Update animations.
+		profile_begin(PS_ANIMATION);
 		sprite_animation_tick(state.delta_time);
+		profile_end();
 
-#if DEBUG
-		// Render terrain colliders.
-		for (u32 i = 0; i < physics_state.static_body_array_count; ++i) {
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-			render_aabb(physics_state.static_body_array[i].aabb, (vec4){1, 1, 1, 1});
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-		}
+		profile_begin(PS_SUBMIT);
 
-		// Render triggers.
-		for (u32 i = 0; i < physics_state.trigger_array_count; ++i) {
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-			render_aabb(physics_state.trigger_array[i].aabb, (vec4){1, 1, 0, 1});
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-		}
+		// Debug lines, toggled with F2.
+		if (render_debug_is_enabled()) {
+			// Render occupied broadphase cells.
+			spatial_grid_render(&physics_state.entity_grid, (vec4){0.3, 0.3, 1, 0.5});
 
-		// Render spawn regions.
-		for (u32 i = 0; i < SPAWN_REGION_COUNT; ++i) {
-			const f32 *spawn_region = &BOX_SPAWN_REGIONS[i][0];
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-			render_quad(spawn_region[0], spawn_region[1], spawn_region[2], spawn_region[3], (vec4){1, 1, 0.5, 0.8});
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+			// Render entity colliders.
+			for (u32 i = 0; i < MAX_ENTITIES; ++i) {
+				if (entity_state.entity_array[i].is_in_use)
+					render_debug_aabb(entity_state.entity_array[i].aabb, (vec4){0, 1, 0, 1});
+			}
+
+			// Render terrain colliders.
+			for (u32 i = 0; i < physics_state.static_body_array_count; ++i) {
+				render_debug_aabb(physics_state.static_body_array[i].aabb, (vec4){1, 1, 1, 1});
+			}
+
+			// Render triggers.
+			for (u32 i = 0; i < physics_state.trigger_array_count; ++i) {
+				render_debug_aabb(physics_state.trigger_array[i].aabb, (vec4){1, 1, 0, 1});
+			}
+
+			// Render spawn regions.
+			for (u32 i = 0; i < SPAWN_REGION_COUNT; ++i) {
+				const f32 *spawn_region = &BOX_SPAWN_REGIONS[i][0];
+				AABB region = {
+					{spawn_region[0] + spawn_region[2] * 0.5f, spawn_region[1] + spawn_region[3] * 0.5f},
+					{spawn_region[2] * 0.5f, spawn_region[3] * 0.5f}
+				};
+				render_debug_aabb(region, (vec4){1, 1, 0.5, 0.8});
+			}
 		}
-#endif
 
-		glUseProgram(render_state.text_shader);
-		render_text(state.score_string, WIDTH / 2, HEIGHT - 20, (vec4){1, 1, 1, 1}, 1);
+		if (render_layer_set(RL_HUD))
+			render_text(state.score_string, WIDTH / 2, HEIGHT - 20, (vec4){1, 1, 1, 1}, 1);
 
 #if DEBUG
+		render_layer_set(RL_DEBUG);
 		char fps[6] = {0};
 		sprintf(fps, "%u", state.frame_rate);
 		render_text(fps, 20, 20, (vec4){1, 1, 1, 1}, 1);
+
+		Render_Stats *stats = &render_state.frame_stats;
+		char render_stats[64] = {0};
+		sprintf(render_stats, "CMDS %u DRAWS %u SKIPPED %u", stats->commands, stats->draw_calls,
+			stats->program_binds_skipped + stats->texture_binds_skipped + stats->vao_binds_skipped + stats->buffer_binds_skipped);
+		render_text(render_stats, 20, 8, (vec4){1, 1, 1, 1}, 0);
 #endif
 
-		SDL_GL_SwapWindow(render_state.window);
+		render_layer_set(RL_DEBUG);
+		profile_render();
+
+		render_end();
+		profile_end();
+
+		profile_end();
+		profile_frame_end();
+
+		if (state.is_headless) {
+			if (--state.headless_frame_count == 0)
+				state.should_quit = 1;
+			continue;
+		}
 
 		// Handle capping to a set FPS.
 		state.frame_time = SDL_GetTicks() - state.time_now;
@@ -855,4 +985,11 @@ int main(void) {
 			SDL_Delay(FRAME_DELAY - state.frame_time);
 		}
 	}
+
+	if (state.is_headless) {
+		render_wait();
+		render_soft_write_ppm(state.headless_output_path);
+	}
+
+	return 0;
 }
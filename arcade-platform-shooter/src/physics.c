@@ -2,6 +2,8 @@
 
 Physics_State physics_state = {0};
 static Physics_State *state = &physics_state;
+
+extern Entity_State entity_state;
 static Hit *hit_array;
 static u32 next_hit_index = 0;
 
@@ -9,6 +11,120 @@ void physics_setup() {
 	state->static_body_array = calloc(MAX_STATIC_BODIES, sizeof(*state->static_body_array));
 	state->trigger_array = calloc(MAX_TRIGGERS, sizeof(*state->trigger_array));
 	hit_array = calloc(MAX_ENTITIES * MAX_ENTITIES, sizeof(*hit_array));
+
+	// Cover the screen plus the off-screen spawn platforms.
+	f32 margin = 4 * SPATIAL_GRID_CELL_SIZE;
+	spatial_grid_init(&state->entity_grid, -margin, -margin, WIDTH + 2 * margin, HEIGHT + 2 * margin, SPATIAL_GRID_CELL_SIZE, MAX_ENTITIES);
+	spatial_grid_init(&state->static_body_grid, -margin, -margin, WIDTH + 2 * margin, HEIGHT + 2 * margin, SPATIAL_GRID_CELL_SIZE, MAX_STATIC_BODIES);
+}
+
+#define GRID_NONE 0xffffffff
+
+void spatial_grid_init(Spatial_Grid *grid, f32 x, f32 y, f32 width, f32 height, f32 cell_size, u32 id_max) {
+	grid->origin[0] = x;
+	grid->origin[1] = y;
+	grid->cell_size = cell_size;
+	grid->columns = (u32)ceilf(width / cell_size);
+	grid->rows = (u32)ceilf(height / cell_size);
+	grid->cell_head_array = malloc(grid->columns * grid->rows * sizeof(*grid->cell_head_array));
+	grid->node_array_max = id_max * 4;
+	grid->node_id_array = malloc(grid->node_array_max * sizeof(*grid->node_id_array));
+	grid->node_next_array = malloc(grid->node_array_max * sizeof(*grid->node_next_array));
+	grid->stamp_array = calloc(id_max, sizeof(*grid->stamp_array));
+	grid->stamp = 0;
+	grid->id_max = id_max;
+	spatial_grid_clear(grid);
+}
+
+void spatial_grid_clear(Spatial_Grid *grid) {
+	memset(grid->cell_head_array, 0xff, grid->columns * grid->rows * sizeof(*grid->cell_head_array));
+	grid->node_count = 0;
+}
+
+static u32 grid_column(Spatial_Grid *grid, f32 x) {
+	f32 column = (x - grid->origin[0]) / grid->cell_size;
+	return column < 0 ? 0 : column >= grid->columns ? grid->columns - 1 : (u32)column;
+}
+
+static u32 grid_row(Spatial_Grid *grid, f32 y) {
+	f32 row = (y - grid->origin[1]) / grid->cell_size;
+	return row < 0 ? 0 : row >= grid->rows ? grid->rows - 1 : (u32)row;
+}
+
+void spatial_grid_insert(Spatial_Grid *grid, u32 id, AABB aabb) {
+	u32 x0 = grid_column(grid, aabb.position[0] - aabb.half_sizes[0]);
+	u32 x1 = grid_column(grid, aabb.position[0] + aabb.half_sizes[0]);
+	u32 y0 = grid_row(grid, aabb.position[1] - aabb.half_sizes[1]);
+	u32 y1 = grid_row(grid, aabb.position[1] + aabb.half_sizes[1]);
+
+	u32 needed = grid->node_count + (x1 - x0 + 1) * (y1 - y0 + 1);
+	if (needed > grid->node_array_max) {
+		while (grid->node_array_max < needed)
+			grid->node_array_max *= 2;
+		grid->node_id_array = realloc(grid->node_id_array, grid->node_array_max * sizeof(*grid->node_id_array));
+		grid->node_next_array = realloc(grid->node_next_array, grid->node_array_max * sizeof(*grid->node_next_array));
+		if (!grid->node_id_array || !grid->node_next_array)
+			error_and_exit(EXIT_FAILURE, "Could not grow spatial grid.");
+	}
+
+	for (u32 y = y0; y <= y1; ++y) {
+		for (u32 x = x0; x <= x1; ++x) {
+			u32 cell = y * grid->columns + x;
+			u32 node = grid->node_count++;
+			grid->node_id_array[node] = id;
+			grid->node_next_array[node] = grid->cell_head_array[cell];
+			grid->cell_head_array[cell] = node;
+		}
+	}
+}
+
+u32 spatial_grid_query(Spatial_Grid *grid, AABB area, u32 *id_array, u32 id_array_max) {
+	u32 x0 = grid_column(grid, area.position[0] - area.half_sizes[0]);
+	u32 x1 = grid_column(grid, area.position[0] + area.half_sizes[0]);
+	u32 y0 = grid_row(grid, area.position[1] - area.half_sizes[1]);
+	u32 y1 = grid_row(grid, area.position[1] + area.half_sizes[1]);
+
+	// On wrap-around old stamps could collide with new ones, so start over.
+	if (++grid->stamp == 0) {
+		memset(grid->stamp_array, 0, grid->id_max * sizeof(*grid->stamp_array));
+		grid->stamp = 1;
+	}
+
+	u32 found = 0;
+	for (u32 y = y0; y <= y1; ++y) {
+		for (u32 x = x0; x <= x1; ++x) {
+			for (u32 node = grid->cell_head_array[y * grid->columns + x]; node != GRID_NONE; node = grid->node_next_array[node]) {
+				u32 id = grid->node_id_array[node];
+				if (grid->stamp_array[id] == grid->stamp)
+					continue;
+				grid->stamp_array[id] = grid->stamp;
+				if (found == id_array_max)
+					return found;
+				id_array[found++] = id;
+			}
+		}
+	}
+
+	return found;
+}
+
+// Outlines every cell holding something, for checking the broadphase.
+void spatial_grid_render(Spatial_Grid *grid, vec4 color) {
+	if (!render_debug_is_enabled())
+		return;
+
+	f32 half_size = grid->cell_size * 0.5f;
+	for (u32 y = 0; y < grid->rows; ++y) {
+		for (u32 x = 0; x < grid->columns; ++x) {
+			if (grid->cell_head_array[y * grid->columns + x] == GRID_NONE)
+				continue;
+			AABB cell = {
+				{grid->origin[0] + x * grid->cell_size + half_size, grid->origin[1] + y * grid->cell_size + half_size},
+				{half_size, half_size}
+			};
+			render_debug_aabb(cell, color);
+		}
+	}
 }
 
 Hit *aabb_intersect_aabb(AABB self, AABB other) {
@@ -48,6 +164,56 @@ Hit *aabb_intersect_aabb(AABB self, AABB other) {
 	return hit;
 }
 
+// Sweeps a point from start to start + delta against the box grown by
+// padding on every side (slab test). On a hit, time is the fraction of
+// delta travelled before contact. Starting inside counts as a hit at 0.
+u8 segment_intersect_aabb(vec2 start, vec2 delta, AABB aabb, f32 padding, Hit *hit) {
+	f32 t_near = 0;
+	f32 t_far = 1;
+	vec2 normal = {0, 0};
+
+	for (u32 axis = 0; axis < 2; ++axis) {
+		f32 min = aabb.position[axis] - aabb.half_sizes[axis] - padding;
+		f32 max = aabb.position[axis] + aabb.half_sizes[axis] + padding;
+
+		if (delta[axis] == 0) {
+			if (start[axis] < min || start[axis] > max)
+				return 0;
+			continue;
+		}
+
+		f32 inverse = 1.0f / delta[axis];
+		f32 t0 = (min - start[axis]) * inverse;
+		f32 t1 = (max - start[axis]) * inverse;
+		f32 side = -fsign(delta[axis]);
+		if (t0 > t1) {
+			f32 t = t0;
+			t0 = t1;
+			t1 = t;
+		}
+
+		if (t0 > t_near) {
+			t_near = t0;
+			normal[0] = axis == 0 ? side : 0;
+			normal[1] = axis == 1 ? side : 0;
+		}
+		if (t1 < t_far)
+			t_far = t1;
+		if (t_near > t_far)
+			return 0;
+	}
+
+	hit->time = t_near;
+	hit->delta[0] = delta[0] * t_near;
+	hit->delta[1] = delta[1] * t_near;
+	hit->position[0] = start[0] + hit->delta[0];
+	hit->position[1] = start[1] + hit->delta[1];
+	hit->normal[0] = normal[0];
+	hit->normal[1] = normal[1];
+
+	return 1;
+}
+
 Static_Body *physics_static_body_create(f32 x, f32 y, f32 width, f32 height, u8 layer_mask) {
 	if (state->static_body_array_count == MAX_STATIC_BODIES) {
 		error_and_exit(EXIT_FAILURE, "No static bodies left.\n");
@@ -56,6 +222,7 @@ Static_Body *physics_static_body_create(f32 x, f32 y, f32 width, f32 height, u8
 	u32 index = state->static_body_array_count++;
 	Static_Body static_body = {.aabb = {{x, y}, {width * 0.5f, height * 0.5f}}, .layer_mask = layer_mask};
 	state->static_body_array[index] = static_body;
+	spatial_grid_insert(&state->static_body_grid, index, static_body.aabb);
 
 	return &state->static_body_array[index];
 }
@@ -72,7 +239,7 @@ Trigger *physics_trigger_create(f32 x, f32 y, f32 width, f32 height) {
 	return &state->trigger_array[index];
 }
 
-static u8 can_collide(u8 a_id, u8 b_id) {
+u8 physics_can_collide(u8 a_id, u8 b_id) {
 	u8 a = state->mask_array[a_id];
 	return ((1 << b_id & a) > 0);
 }
@@ -83,8 +250,8 @@ void physics_tick(f32 delta_time, Entity *entity_array) {
 		if (!entity->is_in_use)
 			continue;
 
-		entity->last_velocity[0] = entity->velocity[0];
-		entity->last_velocity[1] = entity->velocity[1];
+		Entity_Type *type = &entity_state.entity_type_array[entity->type_id];
+		entity->was_airborne = entity->velocity[1] != 0;
 
 		// Triggers. Check first because otherwise the velocity is added and
 		// entities can trigger things through static objects.
@@ -98,11 +265,11 @@ void physics_tick(f32 delta_time, Entity *entity_array) {
 		// Collision events with other entities.
 		for (u32 j = 0; j < MAX_ENTITIES; ++j) {
 			Entity *other = &entity_array[j];
-			if (i == j || !other->is_in_use || !can_collide(entity->layer_mask, other->layer_mask))
+			if (i == j || !other->is_in_use || !physics_can_collide(entity->layer_mask, other->layer_mask))
 				continue;
 			Hit *hit = aabb_intersect_aabb(entity->aabb, other->aabb);
-			if (hit != NULL && entity->on_collide != NULL)
-				entity->on_collide((Collision){ .self_id = i, .other_id = j, .hit = *hit });
+			if (hit != NULL && type->on_collide != NULL)
+				type->on_collide((Collision){ .self_id = i, .other_id = j, .hit = *hit });
 		}
 
 		// Integrate.
@@ -128,7 +295,7 @@ void physics_tick(f32 delta_time, Entity *entity_array) {
 			Static_Body *static_body = &state->static_body_array[j];
 			Hit *hit = aabb_intersect_aabb(entity->aabb, static_body->aabb);
 			if (hit != NULL) {
-				if (!can_collide(entity->layer_mask, static_body->layer_mask))
+				if (!physics_can_collide(entity->layer_mask, static_body->layer_mask))
 					continue;
 
 				entity->aabb.position[0] += hit->delta[0];
@@ -143,14 +310,20 @@ void physics_tick(f32 delta_time, Entity *entity_array) {
 					entity->velocity[1] = 0;
 				was_hit = 1;
 
-				if (entity->on_collide_static != NULL)
-					entity->on_collide_static((Collision){ .self_id = i, .other_id = j, .hit = *hit });
+				if (type->on_collide_static != NULL)
+					type->on_collide_static((Collision){ .self_id = i, .other_id = j, .hit = *hit });
 			}
 		}
 
 		if (was_hit == 0)
 			entity->is_grounded = 0;
 	}
+
+	spatial_grid_clear(&state->entity_grid);
+	for (u32 i = 0; i < MAX_ENTITIES; ++i) {
+		if (entity_array[i].is_in_use)
+			spatial_grid_insert(&state->entity_grid, i, entity_array[i].aabb);
+	}
 }
 
 void physics_cleanup() {
@@ -0,0 +1,142 @@
+#include "shared.h"
+
+Profile_State profile_state = {0};
+static Profile_State *state = &profile_state;
+
+extern Render_State render_state;
+
+// Scopes nest, and a scope entered more than once in a frame adds up.
+// Frames are kept in a ring so the overlay can show percentiles over the
+// last couple of seconds instead of a single jumpy number.
+
+#define PROFILE_TEXT_SIZE 6
+#define PROFILE_LINE_HEIGHT 8
+// Graph pixels per millisecond.
+#define PROFILE_GRAPH_SCALE 2
+#define PROFILE_TARGET_MS (1000.0f / 60.0f)
+
+static const char *scope_name_array[PS_COUNT] = {
+	[PS_FRAME] = "FRAME",
+	[PS_INPUT] = "INPUT",
+	[PS_WAIT] = "WAIT",
+	[PS_SIMULATE] = "SIMULATE",
+	[PS_ANIMATION] = "ANIMATION",
+	[PS_SUBMIT] = "SUBMIT",
+	[PS_EXECUTE] = "EXECUTE",
+	[PS_SWAP] = "SWAP",
+};
+
+void profile_setup() {
+	state->ms_per_tick = 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+void profile_begin(Profile_Scope scope) {
+	if (state->depth == MAX_PROFILE_DEPTH)
+		error_and_exit(EXIT_FAILURE, "Profile scopes nested too deep\n");
+
+	state->depth_array[scope] = state->depth;
+	state->scope_stack[state->depth] = scope;
+	state->start_stack[state->depth] = SDL_GetPerformanceCounter();
+	++state->depth;
+}
+
+void profile_end() {
+	u64 now = SDL_GetPerformanceCounter();
+	--state->depth;
+	Profile_Frame *frame = &state->frame_array[state->frame_index];
+	frame->cpu_ms[state->scope_stack[state->depth]] += (now - state->start_stack[state->depth]) * state->ms_per_tick;
+}
+
+// The render thread's numbers are the latest it has handed back, so they
+// trail the CPU scopes by a frame or two.
+void profile_frame_end() {
+	Profile_Frame *frame = &state->frame_array[state->frame_index];
+	Render_Stats *stats = &render_state.frame_stats;
+
+	frame->cpu_ms[PS_EXECUTE] = stats->execute_ms;
+	frame->cpu_ms[PS_SWAP] = stats->swap_ms;
+	memcpy(frame->gpu_ms, stats->gpu_ms, sizeof(frame->gpu_ms));
+	state->depth_array[PS_EXECUTE] = 0;
+	state->depth_array[PS_SWAP] = 0;
+
+	state->frame_index = (state->frame_index + 1) % PROFILE_HISTORY;
+	if (state->frame_count < PROFILE_HISTORY)
+		++state->frame_count;
+
+	memset(&state->frame_array[state->frame_index], 0, sizeof(Profile_Frame));
+}
+
+void profile_toggle() {
+	state->is_visible = !state->is_visible;
+}
+
+static int sample_compare(const void *a, const void *b) {
+	f32 x = *(const f32 *)a;
+	f32 y = *(const f32 *)b;
+	return (x > y) - (x < y);
+}
+
+// Finished frames, oldest first.
+static Profile_Frame *frame_get(u32 i) {
+	return &state->frame_array[(state->frame_index + PROFILE_HISTORY - state->frame_count + i) % PROFILE_HISTORY];
+}
+
+// Returns 0 if the timer never ran, so unused passes can be left out.
+static u8 percentiles_get(size_t offset, f32 *p50, f32 *p99) {
+	f32 sample_array[PROFILE_HISTORY];
+	u8 has_samples = 0;
+
+	for (u32 i = 0; i < state->frame_count; ++i) {
+		sample_array[i] = *(f32 *)((u8 *)frame_get(i) + offset);
+		has_samples |= sample_array[i] > 0;
+	}
+
+	qsort(sample_array, state->frame_count, sizeof(f32), sample_compare);
+	*p50 = sample_array[state->frame_count * 50 / 100];
+	*p99 = sample_array[state->frame_count * 99 / 100];
+
+	return has_samples;
+}
+
+void profile_render() {
+	if (!state->is_visible || state->frame_count == 0)
+		return;
+
+	// One bar per frame, red when it missed 60fps.
+	vec4 green = {0, 1, 0, 0.8};
+	vec4 red = {1, 0, 0, 0.8};
+	f32 graph_x = WIDTH - PROFILE_HISTORY - 8;
+	f32 graph_y = 8;
+	for (u32 i = 0; i < state->frame_count; ++i) {
+		f32 ms = frame_get(i)->cpu_ms[PS_FRAME];
+		render_quad(graph_x + i, graph_y, 1, ms * PROFILE_GRAPH_SCALE, ms > PROFILE_TARGET_MS ? red : green);
+	}
+	f32 target_y = graph_y + PROFILE_TARGET_MS * PROFILE_GRAPH_SCALE;
+	render_segment((vec2){graph_x, target_y}, (vec2){graph_x + PROFILE_HISTORY, target_y}, (vec4){1, 1, 1, 0.8});
+
+	char text[MAX_TEXT_LENGTH];
+	f32 y = HEIGHT - 12;
+	f32 p50, p99;
+
+	render_text_sized("MS       P50   P99", 8, y, PROFILE_TEXT_SIZE, (vec4){1, 1, 0, 1}, 0);
+	y -= PROFILE_LINE_HEIGHT;
+
+	for (u32 scope = 0; scope < PS_COUNT; ++scope) {
+		percentiles_get(offsetof(Profile_Frame, cpu_ms) + scope * sizeof(f32), &p50, &p99);
+		sprintf(text, "%*s%-*s %5.2f %5.2f", state->depth_array[scope], "", 9 - state->depth_array[scope], scope_name_array[scope], p50, p99);
+		render_text_sized(text, 8, y, PROFILE_TEXT_SIZE, (vec4){1, 1, 1, 1}, 0);
+		y -= PROFILE_LINE_HEIGHT;
+	}
+
+	for (u32 pass = 0; pass < GPU_TIMER_PASSES; ++pass) {
+		if (!percentiles_get(offsetof(Profile_Frame, gpu_ms) + pass * sizeof(f32), &p50, &p99))
+			continue;
+
+		if (pass == GPU_TIMER_PASSES - 1)
+			sprintf(text, "GPU BLIT  %5.2f %5.2f", p50, p99);
+		else
+			sprintf(text, "GPU %u     %5.2f %5.2f", pass, p50, p99);
+		render_text_sized(text, 8, y, PROFILE_TEXT_SIZE, (vec4){0.6, 0.8, 1, 1}, 0);
+		y -= PROFILE_LINE_HEIGHT;
+	}
+}
@@ -0,0 +1,179 @@
+#include "shared.h"
+
+Projectile_State projectile_state = {0};
+static Projectile_State *state = &projectile_state;
+
+extern Entity_State entity_state;
+extern Physics_State physics_state;
+extern Sprite_State sprite_state;
+
+// Projectile sprites are drawn centred on a 16x16 sheet frame.
+#define PROJECTILE_SPRITE_OFFSET -8
+
+void projectile_setup() {
+	u32 capacity = (MAX_PROJECTILES + 3) & ~3u;
+	state->position_x_array = calloc(capacity, sizeof(f32));
+	state->position_y_array = calloc(capacity, sizeof(f32));
+	state->velocity_x_array = calloc(capacity, sizeof(f32));
+	state->velocity_y_array = calloc(capacity, sizeof(f32));
+	state->time_to_live_array = calloc(capacity, sizeof(f32));
+	state->half_size_array = calloc(capacity, sizeof(f32));
+	state->owner_array = calloc(capacity, sizeof(u32));
+	state->damage_array = calloc(capacity, sizeof(u8));
+	state->layer_mask_array = calloc(capacity, sizeof(u8));
+	state->animation_id_array = calloc(capacity, sizeof(u8));
+}
+
+void projectile_spawn(f32 x, f32 y, f32 velocity_x, f32 velocity_y, f32 time_to_live, f32 half_size, u8 damage, u32 owner_id, u8 layer_mask, u32 animation_id) {
+	// Stored as a u8 and used to index the animation array when drawn.
+	if (animation_id >= MAX_SPRITE_ANIMATIONS)
+		error_and_exit(EXIT_FAILURE, "Projectile animation id out of range\n");
+
+	// Under heavy fire it's better to drop a bullet than to stop the game.
+	if (state->count == MAX_PROJECTILES)
+		return;
+
+	u32 index = state->count++;
+	state->position_x_array[index] = x;
+	state->position_y_array[index] = y;
+	state->velocity_x_array[index] = velocity_x;
+	state->velocity_y_array[index] = velocity_y;
+	state->time_to_live_array[index] = time_to_live;
+	state->half_size_array[index] = half_size;
+	state->owner_array[index] = owner_id;
+	state->damage_array[index] = damage;
+	state->layer_mask_array[index] = layer_mask;
+	state->animation_id_array[index] = animation_id;
+}
+
+static void projectile_remove(u32 index) {
+	u32 last = --state->count;
+	if (index == last)
+		return;
+
+	state->position_x_array[index] = state->position_x_array[last];
+	state->position_y_array[index] = state->position_y_array[last];
+	state->velocity_x_array[index] = state->velocity_x_array[last];
+	state->velocity_y_array[index] = state->velocity_y_array[last];
+	state->time_to_live_array[index] = state->time_to_live_array[last];
+	state->half_size_array[index] = state->half_size_array[last];
+	state->owner_array[index] = state->owner_array[last];
+	state->damage_array[index] = state->damage_array[last];
+	state->layer_mask_array[index] = state->layer_mask_array[last];
+	state->animation_id_array[index] = state->animation_id_array[last];
+}
+
+// Finds the earliest thing the projectile touches along this frame's
+// movement. Only candidates from the grid cells around the segment are
+// tested.
+static void projectile_sweep(u32 index, f32 delta_time) {
+	vec2 start = {state->position_x_array[index], state->position_y_array[index]};
+	vec2 delta = {state->velocity_x_array[index] * delta_time, state->velocity_y_array[index] * delta_time};
+	f32 half_size = state->half_size_array[index];
+	u8 layer_mask = state->layer_mask_array[index];
+
+	AABB area = {
+		{start[0] + delta[0] * 0.5f, start[1] + delta[1] * 0.5f},
+		{fabsf(delta[0]) * 0.5f + half_size, fabsf(delta[1]) * 0.5f + half_size}
+	};
+
+	Projectile_Hit best = {0};
+	best.hit.time = FLT_MAX;
+	Hit hit;
+
+	u32 id_array[MAX_ENTITIES];
+	u32 count = spatial_grid_query(&physics_state.entity_grid, area, id_array, MAX_ENTITIES);
+	for (u32 i = 0; i < count; ++i) {
+		Entity *entity = &entity_state.entity_array[id_array[i]];
+		if (id_array[i] == state->owner_array[index] || !entity->is_in_use || !physics_can_collide(layer_mask, entity->layer_mask))
+			continue;
+		if (segment_intersect_aabb(start, delta, entity->aabb, half_size, &hit) && hit.time < best.hit.time) {
+			best.hit = hit;
+			best.target_id = id_array[i];
+			best.is_static = 0;
+		}
+	}
+
+	count = spatial_grid_query(&physics_state.static_body_grid, area, id_array, MAX_ENTITIES);
+	for (u32 i = 0; i < count; ++i) {
+		Static_Body *static_body = &physics_state.static_body_array[id_array[i]];
+		if (!physics_can_collide(layer_mask, static_body->layer_mask))
+			continue;
+		if (segment_intersect_aabb(start, delta, static_body->aabb, half_size, &hit) && hit.time < best.hit.time) {
+			best.hit = hit;
+			best.target_id = id_array[i];
+			best.is_static = 1;
+		}
+	}
+
+	if (best.hit.time == FLT_MAX)
+		return;
+
+	// Spent. Removed with the expired projectiles below. When the hit list
+	// is full the hit is dropped with the bullet, never passed through.
+	state->time_to_live_array[index] = 0;
+	if (state->hit_array_count == MAX_PROJECTILE_HITS)
+		return;
+
+	best.owner_id = state->owner_array[index];
+	best.damage = state->damage_array[index];
+	state->hit_array[state->hit_array_count++] = best;
+}
+
+void projectile_tick(f32 delta_time) {
+	state->hit_array_count = 0;
+
+	for (u32 i = 0; i < state->count; ++i)
+		projectile_sweep(i, delta_time);
+
+#if HAS_SSE2
+	__m128 dt = _mm_set1_ps(delta_time);
+	for (u32 i = 0; i < state->count; i += 4) {
+		__m128 x = _mm_loadu_ps(&state->position_x_array[i]);
+		__m128 y = _mm_loadu_ps(&state->position_y_array[i]);
+		x = _mm_add_ps(x, _mm_mul_ps(_mm_loadu_ps(&state->velocity_x_array[i]), dt));
+		y = _mm_add_ps(y, _mm_mul_ps(_mm_loadu_ps(&state->velocity_y_array[i]), dt));
+		_mm_storeu_ps(&state->position_x_array[i], x);
+		_mm_storeu_ps(&state->position_y_array[i], y);
+		_mm_storeu_ps(&state->time_to_live_array[i], _mm_sub_ps(_mm_loadu_ps(&state->time_to_live_array[i]), dt));
+	}
+#else
+	for (u32 i = 0; i < state->count; ++i) {
+		state->position_x_array[i] += state->velocity_x_array[i] * delta_time;
+		state->position_y_array[i] += state->velocity_y_array[i] * delta_time;
+		state->time_to_live_array[i] -= delta_time;
+	}
+#endif
+
+	// Backwards so a swap only moves a projectile that was already checked.
+	for (u32 i = state->count; i-- > 0;) {
+		if (state->time_to_live_array[i] <= 0)
+			projectile_remove(i);
+	}
+}
+
+void projectile_render() {
+	AABB view = render_view_get();
+
+	for (u32 i = 0; i < state->count; ++i) {
+		Sprite_Animation *sa = &sprite_state.sprite_animation_array[state->animation_id_array[i]];
+		Sprite_Sheet *sheet = &sprite_state.sprite_sheet_array[sa->sprite_sheet_id];
+		vec3 position = {state->position_x_array[i] + PROJECTILE_SPRITE_OFFSET, state->position_y_array[i] + PROJECTILE_SPRITE_OFFSET, 0};
+		if (!render_rect_is_visible(view, position[0], position[1], sheet->frame_width, sheet->frame_height))
+			continue;
+
+		render_sprite_sheet_frame(
+			*sheet,
+			sa->row_coordinate_array[sa->current_frame],
+			sa->column_coordinate_array[sa->current_frame],
+			position,
+			0,
+			(vec4){1, 1, 1, 1},
+			state->velocity_x_array[i] < 0);
+	}
+}
+
+void projectile_clear() {
+	state->count = 0;
+	state->hit_array_count = 0;
+}
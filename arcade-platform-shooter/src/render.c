@@ -3,34 +3,284 @@
 
 #include "./engine/io.h"
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "../deps/lib/stb_image.h"
-
-#include <ft2build.h>
-#include FT_FREETYPE_H
-
 Render_State render_state = {0};
 static Render_State *state = &render_state;
 
-typedef struct character_data {
-	u32 texture;
-	u32 advance_x;
-	u32 advance_y;
-	i32 width;
-	i32 height;
-	i32 left;
-	i32 top;
-} Character_Data;
-
-static Character_Data character_data_array[128];
 
-static FT_Face face;
-static FT_GlyphSlot g;
+// The instance layout is shared with batch.vert, keep them in step.
+typedef char sprite_instance_is_32_bytes[sizeof(Sprite_Instance) == 32 ? 1 : -1];
 
 static void texture_setup(u32 texture_id);
-static u32 shader_setup(const char *vert_path, const char *frag_path);
+static void shader_cache_setup();
+static u32 shader_setup(const char *vert_path, const char *frag_path, const char *defines);
+
+// GL state cache. Binds that would not change anything are skipped and
+// uniform locations are looked up once per program in shader_setup.
+
+#define RENDER_UNBOUND 0xffffffff
+
+static const char *UNIFORM_NAMES[UNIFORM_COUNT] = {
+	[UNIFORM_PROJECTION] = "projection",
+	[UNIFORM_MODEL] = "model",
+	[UNIFORM_COLOR] = "color",
+};
+
+static void render_state_invalidate() {
+	state->bound_program = RENDER_UNBOUND;
+	state->bound_program_index = 0;
+	state->bound_texture = RENDER_UNBOUND;
+	state->bound_vao = RENDER_UNBOUND;
+	state->bound_array_buffer = RENDER_UNBOUND;
+}
+
+static void bind_program(u32 program) {
+	if (state->bound_program == program) {
+		++state->stats.program_binds_skipped;
+		return;
+	}
+
+	for (u32 i = 0; i < state->program_count; ++i) {
+		if (state->program_array[i] == program) {
+			state->bound_program_index = i;
+			break;
+		}
+	}
+
+	glUseProgram(program);
+	state->bound_program = program;
+}
+
+static void bind_texture(u32 texture) {
+	if (state->bound_texture == texture) {
+		++state->stats.texture_binds_skipped;
+		return;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+	state->bound_texture = texture;
+}
+
+static void bind_vao(u32 vao) {
+	if (state->bound_vao == vao) {
+		++state->stats.vao_binds_skipped;
+		return;
+	}
+
+	glBindVertexArray(vao);
+	state->bound_vao = vao;
+}
+
+static void bind_array_buffer(u32 buffer) {
+	if (state->bound_array_buffer == buffer) {
+		++state->stats.buffer_binds_skipped;
+		return;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	state->bound_array_buffer = buffer;
+}
+
+// Location of a uniform in the bound program.
+static i32 uniform_location(Uniform uniform) {
+	++state->stats.uniform_lookups_skipped;
+	return state->uniform_location_array[state->bound_program_index][uniform];
+}
+
+// Streaming vertex ring.
+//
+// Per-frame vertices go into one buffer with a region for each frame in
+// flight. Writes map their range unsynchronised so they never wait on the
+// GPU, and a fence placed at the end of each frame guards its region until
+// the GPU has finished reading it.
+
+// Copies data into this frame's region and returns its offset. Offsets
+// are a whole number of strides, so draws can start at offset / stride.
+static u32 stream_upload(const void *data, u32 size, u32 stride) {
+	if (size > STREAM_REGION_SIZE) {
+		error_and_exit(EXIT_FAILURE, "Stream upload larger than a frame region.");
+	}
+
+	bind_array_buffer(state->stream_vbo);
+
+	u32 region_start = state->stream_frame * STREAM_REGION_SIZE;
+	u32 offset = (state->stream_offset + stride - 1) / stride * stride;
+	if (offset + size > region_start + STREAM_REGION_SIZE) {
+		// Out of room this frame. Orphaning hands back fresh storage, so
+		// the region can be reused without waiting.
+		glBufferData(GL_ARRAY_BUFFER, STREAM_FRAME_COUNT * STREAM_REGION_SIZE, NULL, GL_STREAM_DRAW);
+		offset = (region_start + stride - 1) / stride * stride;
+		++state->stats.stream_orphans;
+	}
+
+	void *memory = glMapBufferRange(GL_ARRAY_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (!memory) {
+		error_and_exit(EXIT_FAILURE, "Failed to map stream buffer");
+	}
+	memcpy(memory, data, size);
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+
+	state->stream_offset = offset + size;
+	state->stats.stream_bytes += size;
+	return offset;
+}
+
+// Fences the frame that was just submitted and moves on to the next
+// region, waiting only if the GPU is still reading it.
+static void stream_end_frame() {
+	state->stream_fence_array[state->stream_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	state->stream_frame = (state->stream_frame + 1) % STREAM_FRAME_COUNT;
+	state->stream_offset = state->stream_frame * STREAM_REGION_SIZE;
+
+	GLsync fence = state->stream_fence_array[state->stream_frame];
+	if (fence == NULL)
+		return;
+
+	if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+		++state->stats.stream_waits;
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, STREAM_FENCE_TIMEOUT) == GL_TIMEOUT_EXPIRED);
+	}
+
+	glDeleteSync(fence);
+	state->stream_fence_array[state->stream_frame] = NULL;
+}
+
+// Points the batch's per-instance attributes at instances starting at
+// offset in the stream buffer.
+static void batch_instance_attributes(u32 offset) {
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Sprite_Instance), (void*)(offset + offsetof(Sprite_Instance, position)));
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Sprite_Instance), (void*)(offset + offsetof(Sprite_Instance, size)));
+	glVertexAttribPointer(3, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(Sprite_Instance), (void*)(offset + offsetof(Sprite_Instance, uv_rect)));
+	glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(Sprite_Instance), (void*)(offset + offsetof(Sprite_Instance, rotation)));
+	glVertexAttribPointer(5, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Sprite_Instance), (void*)(offset + offsetof(Sprite_Instance, color)));
+}
+
+// Points the circle batch's per-instance attributes at instances starting
+// at offset in the stream buffer.
+static void circle_instance_attributes(u32 offset) {
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Circle_Instance), (void*)(offset + offsetof(Circle_Instance, position)));
+	glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(Circle_Instance), (void*)(offset + offsetof(Circle_Instance, radius)));
+	glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(Circle_Instance), (void*)(offset + offsetof(Circle_Instance, thickness)));
+	glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Circle_Instance), (void*)(offset + offsetof(Circle_Instance, color)));
+}
+
+static Render_Sort_Entry *commands_sort(Render_Sort_Entry *entry_array, Render_Sort_Entry *scratch_array, u32 count);
+static void frame_execute(Render_Frame *frame, Render_Sort_Entry *sorted);
+
+// Executes a recorded frame and presents it. This is the only place GL is
+// used after loading. Headless, the software rasteriser draws it instead.
+static void frame_present(Render_Frame *frame) {
+	u64 start = SDL_GetPerformanceCounter();
+	Render_Sort_Entry *sorted = commands_sort(frame->sort_array, state->sort_scratch_array, frame->command_count);
+
+	if (state->is_headless) {
+		render_soft_execute(frame, sorted);
+	} else {
+		frame_execute(frame, sorted);
+		stream_end_frame();
+	}
+
+	// Swapping can block on vsync, so it is timed on its own.
+	u64 swap = SDL_GetPerformanceCounter();
+	if (!state->is_headless)
+		SDL_GL_SwapWindow(state->window);
+	u64 end = SDL_GetPerformanceCounter();
+
+	f64 ms_per_tick = 1000.0 / SDL_GetPerformanceFrequency();
+	state->stats.execute_ms = (swap - start) * ms_per_tick;
+	state->stats.swap_ms = (end - swap) * ms_per_tick;
+
+	// The counters travel back with the frame. The main thread picks them
+	// up when it next records into it.
+	state->stats.commands = frame->command_count;
+	state->stats.commands_dropped = frame->dropped_count;
+	frame->stats = state->stats;
+	memset(&state->stats, 0, sizeof(state->stats));
+}
+
+#if RENDER_THREAD
+// Owns the GL context once the game is running. Frames are consumed in
+// the same order the main thread fills them.
+static int render_thread(void *data) {
+	(void)data;
+	u32 frame_index = 0;
+
+	if (!state->is_headless)
+		SDL_GL_MakeCurrent(state->window, state->context);
+
+	for (;;) {
+		SDL_SemWait(state->frame_ready);
+		frame_present(&state->frame_array[frame_index]);
+		frame_index ^= 1;
+		SDL_SemPost(state->frame_free);
+	}
+
+	return 0;
+}
+#endif
+
+void render_begin() {
+#if RENDER_THREAD
+	// Textures and shaders are created on the main thread while loading.
+	// The first frame hands the context over to the render thread.
+	if (state->thread == NULL) {
+		if (!state->is_headless)
+			SDL_GL_MakeCurrent(state->window, NULL);
+		state->thread = SDL_CreateThread(render_thread, "render", NULL);
+		if (state->thread == NULL) {
+			error_and_exit(EXIT_FAILURE, "Failed to start render thread");
+		}
+	}
+
+	// Blocks while one frame is queued and the other is still executing.
+	SDL_SemWait(state->frame_free);
+#endif
+
+	state->frame = &state->frame_array[state->frame_index];
+	state->frame_stats = state->frame->stats;
+	if (!state->is_headless)
+		SDL_GL_GetDrawableSize(state->window, &state->frame->window_width, &state->frame->window_height);
+
+	state->frame->command_count = 0;
+	state->frame->redraw_layer_mask = 0;
+	state->frame->text_count = 0;
+	state->frame->debug_vertex_count = 0;
+	state->frame->dropped_count = 0;
+	state->layer = 0;
+	state->is_wireframe = 0;
+}
+
+void render_fullscreen_toggle() {
+	if (state->is_headless)
+		return;
+
+	u32 is_fullscreen = SDL_GetWindowFlags(state->window) & SDL_WINDOW_FULLSCREEN;
+	SDL_SetWindowFullscreen(state->window, is_fullscreen ? 0 : SDL_WINDOW_FULLSCREEN_DESKTOP);
+}
+
+void render_end() {
+#if RENDER_THREAD
+	SDL_SemPost(state->frame_ready);
+#else
+	frame_present(state->frame);
+#endif
+	state->frame_index ^= 1;
+}
+
+// Blocks until every submitted frame has been executed.
+void render_wait() {
+#if RENDER_THREAD
+	if (state->thread == NULL)
+		return;
 
-void render_setup() {
+	SDL_SemWait(state->frame_free);
+	SDL_SemWait(state->frame_free);
+	SDL_SemPost(state->frame_free);
+	SDL_SemPost(state->frame_free);
+#endif
+}
+
+// Creates the window, context and every GL object except the font's.
+static void gl_setup() {
 
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG);
@@ -46,13 +296,13 @@ void render_setup() {
 		exit(1);
 	}
 
-	state->window = SDL_CreateWindow(GAME_TITLE, 0, 0, WIDTH * SCALE, HEIGHT * SCALE, SDL_WINDOW_OPENGL);
+	state->window = SDL_CreateWindow(GAME_TITLE, 0, 0, WIDTH * SCALE, HEIGHT * SCALE, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
 	if (!state->window) {
 		printf("Failed to init window: %s\n", SDL_GetError());
 		exit(1);
 	}
 
-	SDL_GL_CreateContext(state->window);
+	state->context = SDL_GL_CreateContext(state->window);
 	if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress)) {
 		error_and_exit(-1, "Failed to init GLAD");
 	}
@@ -62,21 +312,36 @@ void render_setup() {
 	printf("Renderer: %s\n", glGetString(GL_RENDERER));
 	printf("Version:  %s\n", glGetString(GL_VERSION));
 
-	glViewport(0, 0, WIDTH * SCALE, HEIGHT * SCALE);
+	shader_cache_setup();
+
+	// Setup the frame buffer. The game is drawn at its own resolution and
+	// scaled up to the window once at the end of the frame.
+	glGenFramebuffers(1, &state->frame_buffer);
+	glGenRenderbuffers(1, &state->frame_color_buffer);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, state->frame_color_buffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WIDTH, HEIGHT);
+	glBindFramebuffer(GL_FRAMEBUFFER, state->frame_buffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, state->frame_color_buffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		error_and_exit(EXIT_FAILURE, "Failed to create frame buffer");
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glViewport(0, 0, WIDTH, HEIGHT);
 
 	// Setup shader and buffers.
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glEnable(GL_BLEND);
 
-	state->shader = shader_setup("./shaders/default.vert", "./shaders/default.frag");
+	state->shader = shader_setup("./shaders/default.vert", "./shaders/batch.frag", "#define UNIFORM_COLOR\n");
 
 	// Setup color texture.
 	glGenTextures(1, &state->color_texture);
 	texture_setup(state->color_texture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, (u8[4]){255, 255, 255, 255});
 
-	stbi_set_flip_vertically_on_load(1);
-
 	// Setup quad rendering.
 	f32 quad_vertices[] = {
 		 0.5f,  0.5f, 0, 1.0f, 1.0f,
@@ -93,7 +358,7 @@ void render_setup() {
 	glGenBuffers(1, &state->quad_ebo);
 
 	glBindVertexArray(state->quad_vao);
-	glBindBuffer(GL_ARRAY_BUFFER, state->quad_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, state->quad_vbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), quad_vertices, GL_STATIC_DRAW);
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state->quad_ebo);
@@ -108,118 +373,175 @@ void render_setup() {
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
 
-	// Setup line rendering.
-	f32 line_vertices[] = { 0, 0, 0, 1, 1, 1 };
+	// Setup the streaming buffer all per-frame vertices are written to.
+	glGenBuffers(1, &state->stream_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, state->stream_vbo);
+	glBufferData(GL_ARRAY_BUFFER, STREAM_FRAME_COUNT * STREAM_REGION_SIZE, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// Setup line rendering. Lines are drawn straight from the stream, at
+	// offsets that are a whole number of vertices.
+	state->line_shader = shader_setup("./shaders/line.vert", "./shaders/line.frag", NULL);
+	state->line_vertex_array = malloc(MAX_BATCH_LINES * 2 * sizeof(Line_Vertex));
 	glGenVertexArrays(1, &state->line_vao);
-	glGenBuffers(1, &state->line_vbo);
 
 	glBindVertexArray(state->line_vao);
-	glBindBuffer(GL_ARRAY_BUFFER, state->line_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(line_vertices), line_vertices, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, state->stream_vbo);
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(f32), NULL);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Line_Vertex), (void*)offsetof(Line_Vertex, position));
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Line_Vertex), (void*)offsetof(Line_Vertex, color));
 	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
 
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
 
-	// Setup circle shader.
-	state->circle_shader = shader_setup("./shaders/circle.vert", "./shaders/circle.frag");
+	// Setup batch rendering. Every sprite is an instance of the same unit
+	// quad and the vertex shader places it, so only the instances change.
+	f32 batch_corners[] = {
+		 0.5f,  0.5f,
+		 0.5f, -0.5f,
+		-0.5f, -0.5f,
+		-0.5f,  0.5f
+	};
+	state->batch_shader = shader_setup("./shaders/batch.vert", "./shaders/batch.frag", NULL);
+	state->batch_instance_array = malloc(MAX_BATCH_SPRITES * sizeof(Sprite_Instance));
 
-	// Setup text shader.
-	state->text_shader = shader_setup("./shaders/text.vert", "./shaders/text.frag");
+	glGenVertexArrays(1, &state->batch_vao);
+	glGenBuffers(1, &state->batch_corner_vbo);
+	glGenBuffers(1, &state->batch_ebo);
 
-	glGenVertexArrays(1, &state->text_vao);
-	glGenBuffers(1, &state->text_vbo);
+	glBindVertexArray(state->batch_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, state->batch_corner_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(batch_corners), batch_corners, GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(f32), NULL);
+	glEnableVertexAttribArray(0);
 
-	glBindVertexArray(state->text_vao);
-	glBindBuffer(GL_ARRAY_BUFFER, state->text_vbo);
-	glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state->batch_ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(quad_indices), quad_indices, GL_STATIC_DRAW);
 
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(f32), NULL);
-	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, state->stream_vbo);
+	batch_instance_attributes(0);
+	for (u32 i = 1; i <= 5; ++i) {
+		glEnableVertexAttribArray(i);
+		glVertexAttribDivisor(i, 1);
+	}
 
+	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	// Init freetype library.
-	FT_Library ft;
-	if (FT_Init_FreeType(&ft)) {
-		error_and_exit(EXIT_FAILURE, "Could not init freetype.");
-	}
+	// Setup circle rendering. Circles and rings are instances of the same
+	// quad as sprites, sized to the circle so only covered pixels are shaded.
+	state->circle_shader = shader_setup("./shaders/circle.vert", "./shaders/circle.frag", NULL);
+	state->circle_instance_array = malloc(MAX_BATCH_CIRCLES * sizeof(Circle_Instance));
+
+	glGenVertexArrays(1, &state->circle_vao);
+
+	glBindVertexArray(state->circle_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, state->batch_corner_vbo);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(f32), NULL);
+	glEnableVertexAttribArray(0);
 
-	// Load font face.
-	if (FT_New_Face(ft, "./assets/8-BIT_WONDER.TTF", 0, &face)) {
-		error_and_exit(EXIT_FAILURE, "Could not load font.");
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state->batch_ebo);
+
+	glBindBuffer(GL_ARRAY_BUFFER, state->stream_vbo);
+	circle_instance_attributes(0);
+	for (u32 i = 1; i <= 4; ++i) {
+		glEnableVertexAttribArray(i);
+		glVertexAttribDivisor(i, 1);
 	}
 
-	FT_Set_Pixel_Sizes(face, 0, 12 * SCALE);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	g = face->glyph;
+	// Setup text shader.
+	state->text_shader = shader_setup("./shaders/text.vert", "./shaders/text.frag", NULL);
 
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glGenQueries(GPU_TIMER_FRAMES * GPU_TIMER_PASSES, &state->gpu_query_array[0][0]);
+}
 
-	for (u32 i = 0, n = 0; i < 128; ++i) {
-		if (FT_Load_Char(face, i, FT_LOAD_RENDER)) {
-			printf("Failed to load glyph '%c'\n", i);
-			continue;
-		}
+void render_setup(u8 is_headless) {
+	state->is_headless = is_headless;
+	sincos_setup();
+
+	if (is_headless) {
+		render_soft_setup();
+		state->color_texture = render_soft_texture_create((u8[4]){255, 255, 255, 255}, 1, 1, 4);
+	} else {
+		gl_setup();
+	}
+
+	// Load the baked glyph atlas (see tools/font_bake.c).
+	size_t font_file_size;
+	u8 *font_file = io_file_map(FONT_FILE_PATH, &font_file_size);
+	if (!font_file) {
+		error_and_exit(EXIT_FAILURE, "Could not load font, run `make font`.");
+	}
 
-		u32 texture;
-		glGenTextures(1, &texture);
-		glBindTexture(GL_TEXTURE_2D, texture);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_RED,
-			g->bitmap.width,
-			g->bitmap.rows,
-			0,
-			GL_RED,
-			GL_UNSIGNED_BYTE,
-			g->bitmap.buffer
-		);
+	Font_File_Header *font_header = (Font_File_Header *)font_file;
+	if (font_file_size < sizeof(Font_File_Header)
+	    || font_header->magic != FONT_FILE_MAGIC
+	    || font_header->sdf_size != FONT_SDF_SIZE
+	    || font_file_size < sizeof(Font_File_Header) + sizeof(state->character_data_array) + font_header->atlas_width * font_header->atlas_height) {
+		error_and_exit(EXIT_FAILURE, "Font file is out of date, run `make font`.");
+	}
+
+	memcpy(state->character_data_array, font_file + sizeof(Font_File_Header), sizeof(state->character_data_array));
+	u8 *glyph_pixels = font_file + sizeof(Font_File_Header) + sizeof(state->character_data_array);
 
+	if (is_headless) {
+		state->text_texture = render_soft_texture_create(glyph_pixels, font_header->atlas_width, font_header->atlas_height, 1);
+	} else {
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glGenTextures(1, &state->text_texture);
+		glBindTexture(GL_TEXTURE_2D, state->text_texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, font_header->atlas_width, font_header->atlas_height, 0, GL_RED, GL_UNSIGNED_BYTE, glyph_pixels);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-		Character_Data *character_data = &character_data_array[n++];
-		character_data->texture = texture;
-		character_data->advance_x = g->advance.x;
-		character_data->advance_y = g->advance.y;
-		character_data->width = g->bitmap.width;
-		character_data->height = g->bitmap.rows;
-		character_data->top = g->bitmap_top;
-		character_data->left = g->bitmap_left;
+		// Distances interpolate, so the field is sampled linearly.
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+	io_file_unmap(font_file, font_file_size);
+
+	// Setup the command queue. One frame is recorded while the other
+	// executes.
+	for (u32 i = 0; i < 2; ++i) {
+		Render_Frame *frame = &state->frame_array[i];
+		frame->command_array = malloc(MAX_RENDER_COMMANDS * sizeof(Render_Command));
+		frame->sort_array = malloc(MAX_RENDER_COMMANDS * sizeof(Render_Sort_Entry));
+		frame->text_array = malloc(MAX_RENDER_TEXT);
+		frame->debug_vertex_array = malloc(MAX_DEBUG_LINES * 2 * sizeof(Line_Vertex));
+
+		// The world projection is set per frame, text never moves.
+		mat4x4_ortho(frame->projection, 0, WIDTH, 0, HEIGHT, -2.0f, 2.0f);
 	}
+	state->sort_scratch_array = malloc(MAX_RENDER_COMMANDS * sizeof(Render_Sort_Entry));
+	state->frame = &state->frame_array[0];
+
+#if RENDER_THREAD
+	state->frame_ready = SDL_CreateSemaphore(0);
+	state->frame_free = SDL_CreateSemaphore(2);
+#endif
 
-	FT_Done_Face(face);
-	FT_Done_FreeType(ft);
+	if (is_headless)
+		return;
 
 	glGenVertexArrays(1, &state->text_vao);
-	glGenBuffers(1, &state->text_vbo);
 	glBindVertexArray(state->text_vao);
-	glBindBuffer(GL_ARRAY_BUFFER, state->text_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(f32) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, state->stream_vbo);
 	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(f32), 0);
 	glEnableVertexAttribArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
 
-	// Setup projection matrix for each shader.
-	mat4x4_ortho(state->projection, 0, WIDTH, 0, HEIGHT, -2.0f, 2.0f);
-
-	glUseProgram(state->shader);
-	glUniformMatrix4fv(glGetUniformLocation(state->shader, "projection"), 1, GL_FALSE, &state->projection[0][0]);
-	glUseProgram(state->circle_shader);
-	glUniformMatrix4fv(glGetUniformLocation(state->circle_shader, "projection"), 1, GL_FALSE, &state->projection[0][0]);
+	// Setup bound GL state directly, so start tracking from here.
+	render_state_invalidate();
 
-	mat4x4 text_projection;
-	mat4x4_identity(text_projection);
-	mat4x4_ortho(text_projection, 0, WIDTH * SCALE, 0, HEIGHT * SCALE, -2.0f, 2.0f);
-	glUseProgram(state->text_shader);
-	glUniformMatrix4fv(glGetUniformLocation(state->text_shader, "projection"), 1, GL_FALSE, &text_projection[0][0]);
+	// Text and cached layers never move.
+	mat4x4_ortho(state->screen_projection, 0, WIDTH, 0, HEIGHT, -2.0f, 2.0f);
+	bind_program(state->text_shader);
+	glUniformMatrix4fv(uniform_location(UNIFORM_PROJECTION), 1, GL_FALSE, &state->screen_projection[0][0]);
 }
 
 void render_screen_shake_add(f32 duration, f32 magnitude) {
@@ -227,167 +549,469 @@ void render_screen_shake_add(f32 duration, f32 magnitude) {
 	state->screen_shake_magnitude += magnitude;
 }
 
+// Picks this frame's projection. It is applied to everything drawn in
+// the frame when the commands execute.
 void render_screen_shake(f32 delta_time) {
 	if (state->screen_shake_timer <= 0) {
 		state->screen_shake_magnitude = 0;
-		mat4x4_ortho(state->projection, 0, WIDTH, 0, HEIGHT, -2.0f, 2.0f);
-		glUniformMatrix4fv(glGetUniformLocation(state->shader, "projection"), 1, GL_FALSE, &state->projection[0][0]);
-		return;
+		mat4x4_ortho(state->frame->projection, 0, WIDTH, 0, HEIGHT, -2.0f, 2.0f);
 	} else {
 		state->screen_shake_timer -= delta_time;
+		f32 x = frandr(-state->screen_shake_magnitude, state->screen_shake_magnitude);
+		f32 y = frandr(-state->screen_shake_magnitude, state->screen_shake_magnitude);
+		mat4x4_ortho(state->frame->projection, 0 + x, WIDTH + x, 0 + y, HEIGHT + y, -2.0f, 2.0f);
 	}
-	f32 x = frandr(-state->screen_shake_magnitude, state->screen_shake_magnitude);
-	f32 y = frandr(-state->screen_shake_magnitude, state->screen_shake_magnitude);
-	glUseProgram(state->shader);
-	mat4x4_ortho(state->projection, 0 + x, WIDTH + x, 0 + y, HEIGHT + y, -2.0f, 2.0f);
-	glUniformMatrix4fv(glGetUniformLocation(state->shader, "projection"), 1, GL_FALSE, &state->projection[0][0]);
+}
+
+// The part of the world that can end up on screen this frame, shake
+// included. Anything outside it can be skipped before it's recorded.
+AABB render_view_get() {
+	f32 margin = state->screen_shake_timer > 0 ? state->screen_shake_magnitude : 0;
+	return (AABB){
+		{WIDTH * 0.5f, HEIGHT * 0.5f},
+		{WIDTH * 0.5f + margin, HEIGHT * 0.5f + margin}
+	};
+}
+
+// Tests a sprite's rect, at any rotation, against the view.
+u8 render_rect_is_visible(AABB view, f32 x, f32 y, f32 width, f32 height) {
+	f32 radius = 0.5f * sqrtf(width * width + height * height);
+	return fabsf(x + width * 0.5f - view.position[0]) <= view.half_sizes[0] + radius
+	    && fabsf(y + height * 0.5f - view.position[1]) <= view.half_sizes[1] + radius;
 }
 
 static void texture_setup(u32 texture_id) {
-	glBindTexture(GL_TEXTURE_2D, texture_id);
+	bind_texture(texture_id);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);   
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 }
 
-static u32 shader_setup(const char *vert_path, const char *frag_path) {
-	int success;
-	char log[512];
-	char *vertex_source = io_file_read(vert_path);
-	uint32_t vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertex_shader, 1, (const char *const *)&vertex_source, NULL);
-	glCompileShader(vertex_shader);
-	glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
-	if (!success) {
-		glGetShaderInfoLog(vertex_shader, 512, NULL, log);
-		error_and_exit(-1, log);
+// Shader loading.
+//
+// Sources are preprocessed before the driver sees them: `#include "file"`
+// lines are pasted in, resolved against the including file's directory,
+// and a program's defines go straight after its #version line so one
+// source can build several permutations. Every file gets its own #line
+// source string number, so a driver error reads "N:line" where N is the
+// file's index in the table printed alongside it.
+//
+// Linked programs are cached as driver binaries (see Shader_Cache_Header),
+// so a warm start with unchanged sources skips compiling and linking.
+
+typedef struct shader_source {
+	char *data;
+	size_t length;
+	size_t capacity;
+	// Indexed by #line source string number, the top file is 0.
+	char file_name_array[MAX_SHADER_FILES][256];
+	u32 file_count;
+} Shader_Source;
+
+static void shader_source_append(Shader_Source *source, const char *text, size_t length) {
+	if (source->length + length + 1 > source->capacity) {
+		source->capacity = (source->length + length + 1) * 2;
+		source->data = realloc(source->data, source->capacity);
 	}
 
-	char *fragment_source = io_file_read(frag_path);
-	uint32_t fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragment_shader, 1, (const char *const *)&fragment_source, NULL);
-	glCompileShader(fragment_shader);
-	glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
-	if (!success) {
-		glGetShaderInfoLog(fragment_shader, 512, NULL, log);
-		error_and_exit(-1, log);
+	memcpy(source->data + source->length, text, length);
+	source->length += length;
+	source->data[source->length] = 0;
+}
+
+static void shader_source_expand(Shader_Source *source, const char *path, const char *defines, u32 depth) {
+	if (depth == MAX_SHADER_INCLUDE_DEPTH) {
+		printf("%s\n", path);
+		error_and_exit(EXIT_FAILURE, "Shader includes nested too deep, is one including itself?");
 	}
 
-	u32 shader = glCreateProgram();
-	glAttachShader(shader, vertex_shader);
-	glAttachShader(shader, fragment_shader);
-	glLinkProgram(shader);
-	glGetProgramiv(shader, GL_LINK_STATUS, &success);
-	if (!success) {
-		glGetProgramInfoLog(shader, 512, NULL, log);
-		error_and_exit(-1, log);
+	if (source->file_count == MAX_SHADER_FILES) {
+		error_and_exit(EXIT_FAILURE, "Too many shader includes.");
+	}
+
+	char *text = io_file_read(path);
+	if (!text) {
+		error_and_exit(EXIT_FAILURE, "Could not read shader.");
 	}
 
-	free(vertex_source);
-	free(fragment_source);
+	u32 file_number = source->file_count++;
+	snprintf(source->file_name_array[file_number], sizeof(source->file_name_array[file_number]), "%s", path);
 
-	return shader;
+	char directive[32];
+	if (depth > 0) {
+		snprintf(directive, sizeof(directive), "\n#line 1 %u\n", file_number);
+		shader_source_append(source, directive, strlen(directive));
+	}
+
+	const char *directory_end = strrchr(path, '/');
+	int directory_length = directory_end ? directory_end - path + 1 : 0;
+
+	char name[256];
+	char include_path[512];
+	u32 line_number = 0;
+	const char *line = text;
+	while (*line) {
+		const char *end = strchr(line, '\n');
+		size_t length = end ? (size_t)(end - line + 1) : strlen(line);
+		++line_number;
+
+		const char *start = line + strspn(line, " \t");
+		if (sscanf(start, "#include%*[ \t]\"%255[^\"\n]\"", name) == 1) {
+			snprintf(include_path, sizeof(include_path), "%.*s%s", directory_length, path, name);
+			shader_source_expand(source, include_path, NULL, depth + 1);
+			snprintf(directive, sizeof(directive), "\n#line %u %u\n", line_number + 1, file_number);
+			shader_source_append(source, directive, strlen(directive));
+		} else {
+			shader_source_append(source, line, length);
+			if (line_number == 1 && defines) {
+				snprintf(directive, sizeof(directive), "\n#line %u %u\n", line_number + 1, file_number);
+				shader_source_append(source, defines, strlen(defines));
+				shader_source_append(source, directive, strlen(directive));
+			}
+		}
+
+		line += length;
+	}
+
+	free(text);
+}
+
+static u64 hash_fnv1a(u64 hash, const void *data, size_t size) {
+	const u8 *bytes = data;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
 }
 
-typedef struct point {
-	f32 x, y, s, t;
-} Point;
+// Program binaries are core in GL 4.1, and most 3.3 drivers have them
+// through ARB_get_program_binary. Without one binary format the cache
+// stays off and every launch compiles from source.
+static void shader_cache_setup() {
+	GLint format_count = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+	// An unknown enum on drivers without the extension, which is fine.
+	while (glGetError() != GL_NO_ERROR) {
+	}
 
-void render_text(const char *text, f32 x, f32 y, vec4 color, u8 is_centered) {
-	glUseProgram(state->text_shader);
-	glUniform4fv(glGetUniformLocation(state->text_shader, "color"), 1, color);
-	glActiveTexture(GL_TEXTURE0);
-	glBindVertexArray(state->text_vao);
+	*(void **)&state->gl_get_program_binary = SDL_GL_GetProcAddress("glGetProgramBinary");
+	*(void **)&state->gl_program_binary = SDL_GL_GetProcAddress("glProgramBinary");
+	*(void **)&state->gl_program_parameteri = SDL_GL_GetProcAddress("glProgramParameteri");
+	if (format_count <= 0 || !state->gl_get_program_binary || !state->gl_program_binary) {
+		printf("Shader cache unavailable\n");
+		return;
+	}
 
-	x *= SCALE;
-	y *= SCALE;
+	state->shader_cache_path = SDL_GetPrefPath("Falconerd", GAME_TITLE);
+	if (!state->shader_cache_path) {
+		printf("Shader cache unavailable: %s\n", SDL_GetError());
+		return;
+	}
 
-	if (is_centered) {
-		f32 width = 0;
+	// A binary is only good for the driver that made it.
+	const GLenum driver_string_array[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+	u64 hash = 0xcbf29ce484222325ULL;
+	for (u32 i = 0; i < 3; ++i) {
+		const char *string = (const char *)glGetString(driver_string_array[i]);
+		hash = hash_fnv1a(hash, string, strlen(string) + 1);
+	}
+	state->shader_driver_hash = hash;
+}
 
-		for (const char *p = text; *p; ++p) {
-			width += character_data_array[(u32)*p].width;
+// Returns 0 on a miss. Drivers may also refuse a binary from an older
+// build of themselves, which is treated the same.
+static u32 program_cache_load(const char *path, u64 key) {
+	size_t size;
+	u8 *file = io_file_map(path, &size);
+	if (!file) {
+		return 0;
+	}
+
+	Shader_Cache_Header *header = (Shader_Cache_Header *)file;
+	u32 program = 0;
+	if (size > sizeof(Shader_Cache_Header) && header->magic == SHADER_CACHE_MAGIC && header->key == key) {
+		program = glCreateProgram();
+		state->gl_program_binary(program, header->format, file + sizeof(Shader_Cache_Header), size - sizeof(Shader_Cache_Header));
+
+		int success;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (!success) {
+			glDeleteProgram(program);
+			program = 0;
 		}
+	}
 
-		x -= width * 0.5;
+	io_file_unmap(file, size);
+	return program;
+}
+
+static void program_cache_save(u32 program, const char *path, u64 key) {
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) {
+		return;
 	}
 
-	for (const char *p = text; *p; ++p) {
-		Character_Data cd = character_data_array[(u32)*p];
+	size_t size = sizeof(Shader_Cache_Header) + length;
+	u8 *file = malloc(size);
+	Shader_Cache_Header *header = (Shader_Cache_Header *)file;
+	GLenum format;
+	state->gl_get_program_binary(program, length, NULL, &format, file + sizeof(Shader_Cache_Header));
+	*header = (Shader_Cache_Header){SHADER_CACHE_MAGIC, format, key};
 
-		f32 x2 = x + cd.left;
-		f32 y2 = y - (cd.height - cd.top);
-		f32 w = cd.width;
-		f32 h = cd.height;
+	io_file_write(file, size, path);
+	free(file);
+}
 
-		f32 vertices[6][4] = {
-			{x2, y2 + h, 0, 0},
-			{x2, y2, 0, 1},
-			{x2 + w, y2, 1, 1},
+// The whole log, however long the driver makes it. Compile errors also
+// list the files by source string number; link errors pass NULL.
+static void shader_log_exit(u32 object, u8 is_program, const char *path, const Shader_Source *source) {
+	GLint length = 0;
+	if (is_program)
+		glGetProgramiv(object, GL_INFO_LOG_LENGTH, &length);
+	else
+		glGetShaderiv(object, GL_INFO_LOG_LENGTH, &length);
+
+	char *log = calloc(length + 1, 1);
+	if (is_program)
+		glGetProgramInfoLog(object, length + 1, NULL, log);
+	else
+		glGetShaderInfoLog(object, length + 1, NULL, log);
+
+	printf("%s\n", path);
+	for (u32 i = 0; source && i < source->file_count; ++i) {
+		printf("  %u: %s\n", i, source->file_name_array[i]);
+	}
+	error_and_exit(-1, log);
+}
 
-			{x2, y2 + h, 0, 0},
-			{x2 + w, y2, 1, 1},
-			{x2 + w, y2 + h, 1, 0}
-		};
+static u32 shader_compile(GLenum type, const Shader_Source *source, const char *path) {
+	int success;
+	u32 shader = glCreateShader(type);
+	glShaderSource(shader, 1, (const char *const *)&source->data, NULL);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (!success) {
+		shader_log_exit(shader, 0, path, source);
+	}
+
+	return shader;
+}
 
-		glBindTexture(GL_TEXTURE_2D, cd.texture);
-		glBindBuffer(GL_ARRAY_BUFFER, state->text_vbo);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof vertices, vertices);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		x += (cd.advance_x / 64);
+// `defines` is pasted in as is, e.g. "#define UNIFORM_COLOR\n", or NULL.
+static u32 shader_setup(const char *vert_path, const char *frag_path, const char *defines) {
+	Shader_Source vertex_source = {0};
+	Shader_Source fragment_source = {0};
+	shader_source_expand(&vertex_source, vert_path, defines, 0);
+	shader_source_expand(&fragment_source, frag_path, defines, 0);
+
+	u32 shader = 0;
+	u64 key = 0;
+	char cache_path[1024] = {0};
+	if (state->shader_cache_path) {
+		// The terminators keep the two sources from running together.
+		key = hash_fnv1a(state->shader_driver_hash, vertex_source.data, vertex_source.length + 1);
+		key = hash_fnv1a(key, fragment_source.data, fragment_source.length + 1);
+		snprintf(cache_path, sizeof(cache_path), "%sshader_%016llx.bin", state->shader_cache_path, (unsigned long long)key);
+		shader = program_cache_load(cache_path, key);
 	}
-	glBindVertexArray(0);
-	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if (!shader) {
+		u32 vertex_shader = shader_compile(GL_VERTEX_SHADER, &vertex_source, vert_path);
+		u32 fragment_shader = shader_compile(GL_FRAGMENT_SHADER, &fragment_source, frag_path);
+
+		shader = glCreateProgram();
+		if (state->shader_cache_path && state->gl_program_parameteri) {
+			state->gl_program_parameteri(shader, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+		glAttachShader(shader, vertex_shader);
+		glAttachShader(shader, fragment_shader);
+		glLinkProgram(shader);
+
+		int success;
+		glGetProgramiv(shader, GL_LINK_STATUS, &success);
+		if (!success) {
+			shader_log_exit(shader, 1, frag_path, NULL);
+		}
+
+		glDetachShader(shader, vertex_shader);
+		glDetachShader(shader, fragment_shader);
+		glDeleteShader(vertex_shader);
+		glDeleteShader(fragment_shader);
+
+		if (state->shader_cache_path) {
+			program_cache_save(shader, cache_path, key);
+		}
+	}
+
+	if (state->program_count == MAX_SHADERS) {
+		error_and_exit(EXIT_FAILURE, "No shader slots left.");
+	}
+
+	// Unused uniforms come back as -1, which glUniform ignores.
+	u32 index = state->program_count++;
+	state->program_array[index] = shader;
+	for (u32 i = 0; i < UNIFORM_COUNT; ++i) {
+		state->uniform_location_array[index][i] = glGetUniformLocation(shader, UNIFORM_NAMES[i]);
+	}
+
+	free(vertex_source.data);
+	free(fragment_source.data);
+
+	return shader;
 }
 
-void render_circle(f32 x, f32 y, f32 radius, vec4 color) {
-	mat4x4 model;
-	mat4x4_identity(model);
+// Render command queue.
+//
+// The render_* draw functions only record a command with a sort key. At
+// render_end the commands are radix sorted and executed, so draw order
+// comes from the key (layer, then pipeline, texture and depth) rather
+// than from the order game code happens to run in, and commands that
+// share state end up next to each other.
+
+static Render_Command *command_push(Render_Command_Type type, u32 texture, f32 depth) {
+	Render_Frame *frame = state->frame;
+	if (frame->command_count == MAX_RENDER_COMMANDS) {
+		++frame->dropped_count;
+		return NULL;
+	}
 
-	mat4x4_translate(model, WIDTH / 2, HEIGHT / 2, 0.0f);
-	mat4x4_scale_aniso(model, model, WIDTH, HEIGHT, 1.0f);
+	// Order floats by their bits: flip negatives entirely, set the sign
+	// bit on positives.
+	u32 depth_bits;
+	memcpy(&depth_bits, &depth, sizeof(depth_bits));
+	depth_bits = depth_bits & 0x80000000 ? ~depth_bits : depth_bits | 0x80000000;
+
+	u32 index = frame->command_count++;
+	frame->sort_array[index].key = (u64)state->layer << 56 | (u64)type << 48 | (u64)(texture & 0xffff) << 32 | depth_bits;
+	frame->sort_array[index].index = index;
+
+	Render_Command *command = &frame->command_array[index];
+	command->type = type;
+	command->is_wireframe = state->is_wireframe;
+	command->texture = texture;
+	return command;
+}
 
-	float r[] = {radius * SCALE};
+// Returns 0 when the layer is cached and still clean, so drawing it can
+// be skipped. Its texture from an earlier frame is shown instead.
+u8 render_layer_set(u8 layer) {
+	state->layer = layer;
 
-	glUniformMatrix4fv(glGetUniformLocation(state->circle_shader, "model"), 1, GL_FALSE, &model[0][0]);
-	glUniform4fv(glGetUniformLocation(state->circle_shader, "color"), 1, color);
-	glUniform2fv(glGetUniformLocation(state->circle_shader, "position"), 1, (vec2){x * SCALE, y * SCALE});
-	glUniform1fv(glGetUniformLocation(state->circle_shader, "radius"), 1, &r[0]);
+	u32 bit = layer < MAX_CACHED_LAYERS ? 1u << layer : 0;
+	if (!(state->cached_layer_mask & bit) || state->frame->redraw_layer_mask & bit)
+		return 1;
+	if (!(state->dirty_layer_mask & bit))
+		return 0;
 
-	glBindTexture(GL_TEXTURE_2D, state->color_texture);
-	glBindVertexArray(state->quad_vao);
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	state->dirty_layer_mask &= ~bit;
+	state->frame->redraw_layer_mask |= bit;
+	return 1;
 }
 
-void render_quad(f32 x, f32 y, f32 width, f32 height, vec4 color) {
-	mat4x4 model;
-	mat4x4_identity(model);
+// Keeps a rarely changing layer in a texture of its own, redrawn only
+// after render_layer_dirty. World layers move with the screen shake,
+// others stay fixed to the screen. Call while loading, before the first
+// frame. The software rasteriser redraws every layer, so it is a no-op
+// headless.
+void render_layer_cache(u8 layer, u8 is_world) {
+	if (state->is_headless)
+		return;
+	if (layer >= MAX_CACHED_LAYERS) {
+		error_and_exit(EXIT_FAILURE, "Layer can not be cached.");
+	}
 
-	mat4x4_translate(model, x + width * 0.5f, y + height * 0.5f, 0.0f);
-	mat4x4_scale_aniso(model, model, width, height, 1.0f);
+	glGenTextures(1, &state->layer_texture_array[layer]);
+	texture_setup(state->layer_texture_array[layer]);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, WIDTH, HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 
-	glUniformMatrix4fv(glGetUniformLocation(state->shader, "model"), 1, GL_FALSE, &model[0][0]);
-	glUniform4fv(glGetUniformLocation(state->shader, "color"), 1, color);
+	glGenFramebuffers(1, &state->layer_frame_buffer_array[layer]);
+	glBindFramebuffer(GL_FRAMEBUFFER, state->layer_frame_buffer_array[layer]);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, state->layer_texture_array[layer], 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		error_and_exit(EXIT_FAILURE, "Failed to create layer frame buffer");
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	render_state_invalidate();
 
-	glBindTexture(GL_TEXTURE_2D, state->color_texture);
-	glBindVertexArray(state->quad_vao);
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	state->cached_layer_mask |= 1u << layer;
+	state->dirty_layer_mask |= 1u << layer;
+	if (is_world)
+		state->world_layer_mask |= 1u << layer;
 }
 
-void render_point(vec2 position, vec4 color) {
-	mat4x4 model;
-	mat4x4_identity(model);
+void render_layer_dirty(u8 layer) {
+	if (layer < MAX_CACHED_LAYERS)
+		state->dirty_layer_mask |= 1u << layer;
+}
 
-	mat4x4_translate(model, position[0], position[1], 0);
+void render_wireframe_set(u8 is_wireframe) {
+	state->is_wireframe = is_wireframe;
+}
 
-	glUniformMatrix4fv(glGetUniformLocation(state->shader, "model"), 1, GL_FALSE, &model[0][0]);
-	glUniform4fv(glGetUniformLocation(state->shader, "color"), 1, color);
+void render_text(const char *text, f32 x, f32 y, vec4 color, u8 is_centered) {
+	render_text_sized(text, x, y, FONT_SIZE, color, is_centered);
+}
 
-	glBindTexture(GL_TEXTURE_2D, state->color_texture);
-	glBindVertexArray(state->quad_vao);
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+// Size is the pixel height. Glyph metrics are stored at
+// FONT_SDF_SIZE and scaled to match.
+void render_text_sized(const char *text, f32 x, f32 y, f32 size, vec4 color, u8 is_centered) {
+	Render_Frame *frame = state->frame;
+	u32 length = strlen(text);
+	if (length > MAX_TEXT_LENGTH)
+		length = MAX_TEXT_LENGTH;
+	if (length == 0 || frame->text_count + length > MAX_RENDER_TEXT)
+		return;
+
+	Render_Command *command = command_push(RC_TEXT, state->text_texture, 0);
+	if (command == NULL)
+		return;
+
+	memcpy(&frame->text_array[frame->text_count], text, length);
+	command->data.text.offset = frame->text_count;
+	command->data.text.length = length;
+	command->data.text.x = x;
+	command->data.text.y = y;
+	command->data.text.size = size;
+	command->data.text.color = color_pack(color);
+	command->data.text.is_centered = is_centered;
+	frame->text_count += length;
+}
+
+void render_circle(f32 x, f32 y, f32 radius, vec4 color) {
+	render_ring(x, y, radius, radius, color);
+}
+
+// A ring whose outer edge is at radius, thickness units deep.
+void render_ring(f32 x, f32 y, f32 radius, f32 thickness, vec4 color) {
+	Render_Command *command = command_push(RC_CIRCLE, state->color_texture, 0);
+	if (command == NULL)
+		return;
+
+	command->data.circle.position[0] = x;
+	command->data.circle.position[1] = y;
+	command->data.circle.radius = radius;
+	command->data.circle.thickness = thickness;
+	command->data.circle.color = color_pack(color);
+}
+
+void render_quad(f32 x, f32 y, f32 width, f32 height, vec4 color) {
+	Render_Command *command = command_push(RC_QUAD, state->color_texture, 0);
+	if (command == NULL)
+		return;
+
+	command->data.quad.x = x;
+	command->data.quad.y = y;
+	command->data.quad.width = width;
+	command->data.quad.height = height;
+	command->data.quad.color = color_pack(color);
+}
+
+// A unit quad centred on the position.
+void render_point(vec2 position, vec4 color) {
+	render_quad(position[0] - 0.5f, position[1] - 0.5f, 1, 1, color);
 }
 
 void render_aabb(AABB aabb, vec4 color) {
@@ -395,24 +1019,15 @@ void render_aabb(AABB aabb, vec4 color) {
 }
 
 void render_segment(vec2 start, vec2 end, vec4 color) {
-	f32 x = end[0] - start[0];
-	f32 y = end[1] - start[1];
-	f32 line[6] = {0, 0, 0, x, y, 0};
-	mat4x4 model;
-	mat4x4_identity(model);
-
-	mat4x4_translate(model, start[0], start[1], 0);
-
-	glUniformMatrix4fv(glGetUniformLocation(state->shader, "model"), 1, GL_FALSE, &model[0][0]);
-	glUniform4fv(glGetUniformLocation(state->shader, "color"), 1, color);
+	Render_Command *command = command_push(RC_SEGMENT, state->color_texture, 0);
+	if (command == NULL)
+		return;
 
-	glBindTexture(GL_TEXTURE_2D, state->color_texture);
-	glBindVertexArray(state->line_vao);
-	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, state->line_vbo);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, (sizeof line), &line);
-	glDrawArrays(GL_LINES, 0, 2);
-	glDisableVertexAttribArray(0);
+	command->data.segment.start[0] = start[0];
+	command->data.segment.start[1] = start[1];
+	command->data.segment.end[0] = end[0];
+	command->data.segment.end[1] = end[1];
+	command->data.segment.color = color_pack(color);
 }
 
 void render_ray(vec2 start, vec2 direction, f32 length, vec4 color, u8 arrow) {
@@ -434,24 +1049,78 @@ void render_ray(vec2 start, vec2 direction, f32 length, vec4 color, u8 arrow) {
 	}
 }
 
-void render_sprite(Texture texture, f32 size[2], vec3 position, f32 tex_coords[8], f32 rotation, vec4 color, u8 is_flipped) {
-	f32 vertices[4][5] = {
-		{ 0.5f,  0.5f, 0, 1.0f, 1.0f},
-		{ 0.5f, -0.5f, 0, 1.0f, 0.0f},
-		{-0.5f, -0.5f, 0, 0.0f, 0.0f},
-		{-0.5f,  0.5f, 0, 0.0f, 1.0f}
-	};
+// Debug lines skip the command queue: they are appended to one array per
+// frame and drawn in a single GL_LINES draw after everything else. While
+// debug drawing is off they cost a branch.
+void render_debug_set(u8 is_enabled) {
+	state->is_debug_enabled = is_enabled;
+}
 
-	if (tex_coords) {
-		vertices[0][3] = tex_coords[0];
-		vertices[0][4] = tex_coords[1];
-		vertices[1][3] = tex_coords[2];
-		vertices[1][4] = tex_coords[3];
-		vertices[2][3] = tex_coords[4];
-		vertices[2][4] = tex_coords[5];
-		vertices[3][3] = tex_coords[6];
-		vertices[3][4] = tex_coords[7];
-	}
+void render_debug_toggle() {
+	state->is_debug_enabled = !state->is_debug_enabled;
+}
+
+u8 render_debug_is_enabled() {
+	return state->is_debug_enabled;
+}
+
+void render_debug_line(vec2 start, vec2 end, vec4 color) {
+	Render_Frame *frame = state->frame;
+	if (!state->is_debug_enabled || frame->debug_vertex_count == MAX_DEBUG_LINES * 2)
+		return;
+
+	u32 packed = color_pack(color);
+	Line_Vertex *vertex = &frame->debug_vertex_array[frame->debug_vertex_count];
+	vertex[0] = (Line_Vertex){{start[0], start[1]}, packed};
+	vertex[1] = (Line_Vertex){{end[0], end[1]}, packed};
+	frame->debug_vertex_count += 2;
+}
+
+void render_debug_aabb(AABB aabb, vec4 color) {
+	if (!state->is_debug_enabled)
+		return;
+
+	f32 x0 = aabb.position[0] - aabb.half_sizes[0];
+	f32 y0 = aabb.position[1] - aabb.half_sizes[1];
+	f32 x1 = aabb.position[0] + aabb.half_sizes[0];
+	f32 y1 = aabb.position[1] + aabb.half_sizes[1];
+	render_debug_line((vec2){x0, y0}, (vec2){x1, y0}, color);
+	render_debug_line((vec2){x1, y0}, (vec2){x1, y1}, color);
+	render_debug_line((vec2){x1, y1}, (vec2){x0, y1}, color);
+	render_debug_line((vec2){x0, y1}, (vec2){x0, y0}, color);
+}
+
+// A small cross, so it shows at any scale.
+void render_debug_point(vec2 position, vec4 color) {
+	render_debug_line((vec2){position[0] - 2, position[1]}, (vec2){position[0] + 2, position[1]}, color);
+	render_debug_line((vec2){position[0], position[1] - 2}, (vec2){position[0], position[1] + 2}, color);
+}
+
+static u16 uv_quantise(f32 uv) {
+	uv = uv < 0 ? 0 : uv > 1 ? 1 : uv;
+	return (u16)(uv * 65535.0f + 0.5f);
+}
+
+// Sprites become instances for the sprite batch. The vertex shader builds
+// the transform, and consecutive sprites on one texture are one draw.
+void render_sprite(Texture texture, f32 size[2], vec3 position, f32 uv_rect[4], f32 rotation, vec4 color, u8 is_flipped) {
+	static f32 default_uv_rect[4] = {0, 0, 1, 1};
+
+	Render_Command *command = command_push(RC_SPRITE, texture.id, position[2]);
+	if (command == NULL)
+		return;
+
+	if (uv_rect == NULL)
+		uv_rect = default_uv_rect;
+
+	// The rect is relative to the texture, which may be part of an atlas.
+	f32 atlas_uv_rect[4];
+	f32 uv_width = texture.uv_rect[2] - texture.uv_rect[0];
+	f32 uv_height = texture.uv_rect[3] - texture.uv_rect[1];
+	atlas_uv_rect[0] = texture.uv_rect[0] + uv_rect[0] * uv_width;
+	atlas_uv_rect[1] = texture.uv_rect[1] + uv_rect[1] * uv_height;
+	atlas_uv_rect[2] = texture.uv_rect[0] + uv_rect[2] * uv_width;
+	atlas_uv_rect[3] = texture.uv_rect[1] + uv_rect[3] * uv_height;
 
 	f32 width = texture.width;
 	f32 height = texture.height;
@@ -461,22 +1130,15 @@ void render_sprite(Texture texture, f32 size[2], vec3 position, f32 tex_coords[8
 		height = size[1];
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, state->quad_vbo);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof vertices, vertices);
-
-	mat4x4 model;
-	mat4x4_identity(model);
-
-	mat4x4_translate(model, position[0] + width * 0.5f, position[1] + height * 0.5f, 0.0f);
-	mat4x4_rotate(model, model, 0, 0, 1, rotation);
-	mat4x4_scale_aniso(model, model, is_flipped ? -width : width, height, 1.0f);
-
-	glUniformMatrix4fv(glGetUniformLocation(state->shader, "model"), 1, GL_FALSE, &model[0][0]);
-	glUniform4fv(glGetUniformLocation(state->shader, "color"), 1, color);
-
-	glBindTexture(GL_TEXTURE_2D, texture.id);
-	glBindVertexArray(state->quad_vao);
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	Sprite_Instance *instance = &command->data.sprite;
+	instance->position[0] = position[0] + width * 0.5f;
+	instance->position[1] = position[1] + height * 0.5f;
+	instance->size[0] = is_flipped ? -width : width;
+	instance->size[1] = height;
+	for (u32 i = 0; i < 4; ++i)
+		instance->uv_rect[i] = uv_quantise(atlas_uv_rect[i]);
+	instance->rotation = rotation;
+	instance->color = color_pack(color);
 }
 
 void render_sprite_sheet_frame(Sprite_Sheet sprite_sheet, u8 row, u8 column, vec3 position, f32 rotation, vec4 color, u8 is_flipped) {
@@ -484,21 +1146,478 @@ void render_sprite_sheet_frame(Sprite_Sheet sprite_sheet, u8 row, u8 column, vec
 	f32 h = 1.0f / ((f32)sprite_sheet.texture.height / (f32)sprite_sheet.frame_height);
 	f32 x = (f32)column * w;
 	f32 y = (f32)row * h;
-	f32 tex_coords[8] = {x + w, y + h, x + w, y, x, y, x, y + h};
+	f32 uv_rect[4] = {x, y, x + w, y + h};
 	f32 size_override[2] = {(f32)sprite_sheet.frame_width, (f32)sprite_sheet.frame_height};
 
-	render_sprite(sprite_sheet.texture, size_override, position, tex_coords, rotation, color, is_flipped);
+	render_sprite(sprite_sheet.texture, size_override, position, uv_rect, rotation, color, is_flipped);
+}
+
+// Execution. Everything below runs at render_end and is the only code
+// that talks to GL per frame.
+
+static void batch_flush() {
+	if (state->batch_count == 0)
+		return;
+
+	bind_program(state->batch_shader);
+	bind_texture(state->batch_texture);
+	bind_vao(state->batch_vao);
+	u32 offset = stream_upload(state->batch_instance_array, state->batch_count * sizeof(Sprite_Instance), sizeof(Sprite_Instance));
+	batch_instance_attributes(offset);
+	glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, state->batch_count);
+	++state->stats.draw_calls;
+
+	state->batch_count = 0;
+}
+
+static void circle_batch_flush() {
+	if (state->circle_count == 0)
+		return;
+
+	bind_program(state->circle_shader);
+	bind_vao(state->circle_vao);
+	u32 offset = stream_upload(state->circle_instance_array, state->circle_count * sizeof(Circle_Instance), sizeof(Circle_Instance));
+	circle_instance_attributes(offset);
+	glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, state->circle_count);
+	++state->stats.draw_calls;
+
+	state->circle_count = 0;
+}
+
+static void lines_draw(const Line_Vertex *vertex_array, u32 vertex_count) {
+	bind_program(state->line_shader);
+	bind_vao(state->line_vao);
+	u32 offset = stream_upload(vertex_array, vertex_count * sizeof(Line_Vertex), sizeof(Line_Vertex));
+	glDrawArrays(GL_LINES, offset / sizeof(Line_Vertex), vertex_count);
+	++state->stats.draw_calls;
+}
+
+static void line_batch_flush() {
+	if (state->line_vertex_count == 0)
+		return;
+
+	lines_draw(state->line_vertex_array, state->line_vertex_count);
+	state->line_vertex_count = 0;
+}
+
+// A batch only holds one kind of command, so anything else coming
+// through draws what it has first.
+static void batches_flush_other(Render_Command_Type type) {
+	if (type != RC_SPRITE && type != RC_QUAD)
+		batch_flush();
+	if (type != RC_CIRCLE)
+		circle_batch_flush();
+	if (type != RC_SEGMENT)
+		line_batch_flush();
+}
+
+static void batches_flush() {
+	batch_flush();
+	circle_batch_flush();
+	line_batch_flush();
+}
+
+static void text_execute(Render_Frame *frame, Render_Command *command) {
+	static f32 vertices[MAX_TEXT_LENGTH * 6][4];
+	const char *text = &frame->text_array[command->data.text.offset];
+	u32 length = command->data.text.length;
+
+	f32 scale = command->data.text.size / FONT_SDF_SIZE;
+	f32 x = command->data.text.x;
+	f32 y = command->data.text.y;
+
+	if (command->data.text.is_centered) {
+		f32 width = 0;
+
+		// Bitmaps include the distance field's spread, so measure by advance.
+		for (u32 i = 0; i < length; ++i) {
+			width += (state->character_data_array[(u32)text[i] & 127].advance_x / 64) * scale;
+		}
+
+		x -= width * 0.5;
+	}
+
+	for (u32 i = 0; i < length; ++i) {
+		Character_Data cd = state->character_data_array[(u32)text[i] & 127];
+
+		f32 x2 = x + cd.left * scale;
+		f32 y2 = y - (cd.height - cd.top) * scale;
+		f32 w = cd.width * scale;
+		f32 h = cd.height * scale;
+		f32 u0 = cd.uv_rect[0];
+		f32 v0 = cd.uv_rect[1];
+		f32 u1 = cd.uv_rect[2];
+		f32 v1 = cd.uv_rect[3];
+
+		f32 quad[6][4] = {
+			{x2, y2 + h, u0, v0},
+			{x2, y2, u0, v1},
+			{x2 + w, y2, u1, v1},
+
+			{x2, y2 + h, u0, v0},
+			{x2 + w, y2, u1, v1},
+			{x2 + w, y2 + h, u1, v0}
+		};
+
+		memcpy(&vertices[i * 6], quad, sizeof(quad));
+		x += (cd.advance_x / 64) * scale;
+	}
+
+	vec4 color;
+	color_unpack(command->data.text.color, color);
+
+	bind_program(state->text_shader);
+	glUniform4fv(uniform_location(UNIFORM_COLOR), 1, color);
+	bind_texture(state->text_texture);
+	bind_vao(state->text_vao);
+	u32 offset = stream_upload(vertices, length * 6 * sizeof(vertices[0]), sizeof(vertices[0]));
+	glDrawArrays(GL_TRIANGLES, offset / sizeof(vertices[0]), length * 6);
+	++state->stats.draw_calls;
+}
+
+// LSD radix sort on the keys, a byte per pass. It is stable, so commands
+// with equal keys keep their submission order. Passes where every key
+// shares the same byte are skipped, which is most of them in practice.
+static Render_Sort_Entry *commands_sort(Render_Sort_Entry *entry_array, Render_Sort_Entry *scratch_array, u32 count) {
+	if (count == 0)
+		return entry_array;
+
+	for (u32 shift = 0; shift < 64; shift += 8) {
+		u32 offset_array[256] = {0};
+		for (u32 i = 0; i < count; ++i) {
+			++offset_array[(entry_array[i].key >> shift) & 0xff];
+		}
+
+		if (offset_array[(entry_array[0].key >> shift) & 0xff] == count)
+			continue;
+
+		u32 total = 0;
+		for (u32 i = 0; i < 256; ++i) {
+			u32 bucket_count = offset_array[i];
+			offset_array[i] = total;
+			total += bucket_count;
+		}
+
+		for (u32 i = 0; i < count; ++i) {
+			scratch_array[offset_array[(entry_array[i].key >> shift) & 0xff]++] = entry_array[i];
+		}
+
+		Render_Sort_Entry *swap = entry_array;
+		entry_array = scratch_array;
+		scratch_array = swap;
+	}
+
+	return entry_array;
+}
+
+// Scales the finished frame up to the window by the largest whole number
+// that fits and centres it, so every game pixel stays square.
+static void frame_blit(Render_Frame *frame) {
+	i32 scale_x = frame->window_width / WIDTH;
+	i32 scale_y = frame->window_height / HEIGHT;
+	i32 scale = scale_x < scale_y ? scale_x : scale_y;
+	if (scale < 1)
+		scale = 1;
+
+	i32 x = (frame->window_width - WIDTH * scale) / 2;
+	i32 y = (frame->window_height - HEIGHT * scale) / 2;
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glClearColor(0, 0, 0, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBlitFramebuffer(0, 0, WIDTH, HEIGHT, x, y, x + WIDTH * scale, y + HEIGHT * scale, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+}
+
+static void projection_upload(mat4x4 projection) {
+	bind_program(state->shader);
+	glUniformMatrix4fv(uniform_location(UNIFORM_PROJECTION), 1, GL_FALSE, &projection[0][0]);
+	bind_program(state->circle_shader);
+	glUniformMatrix4fv(uniform_location(UNIFORM_PROJECTION), 1, GL_FALSE, &projection[0][0]);
+	bind_program(state->batch_shader);
+	glUniformMatrix4fv(uniform_location(UNIFORM_PROJECTION), 1, GL_FALSE, &projection[0][0]);
+	bind_program(state->line_shader);
+	glUniformMatrix4fv(uniform_location(UNIFORM_PROJECTION), 1, GL_FALSE, &projection[0][0]);
+}
+
+// Sprites and solid quads share one batch, quads as a white texture.
+static void batch_add(u32 texture, Sprite_Instance *instance) {
+	if (state->batch_texture != texture || state->batch_count == MAX_BATCH_SPRITES) {
+		batch_flush();
+		state->batch_texture = texture;
+	}
+	state->batch_instance_array[state->batch_count++] = *instance;
+}
+
+// Executes the sorted commands from start up to end.
+static void commands_execute(Render_Frame *frame, Render_Sort_Entry *sorted, u32 start, u32 end) {
+	u8 is_wireframe = 0;
+
+	for (u32 i = start; i < end; ++i) {
+		Render_Command *command = &frame->command_array[sorted[i].index];
+
+		if (command->is_wireframe != is_wireframe) {
+			batches_flush();
+			is_wireframe = command->is_wireframe;
+			glPolygonMode(GL_FRONT_AND_BACK, is_wireframe ? GL_LINE : GL_FILL);
+		}
+
+		batches_flush_other(command->type);
+
+		switch (command->type) {
+		case RC_SPRITE:
+			batch_add(command->texture, &command->data.sprite);
+			break;
+		case RC_QUAD: {
+			Sprite_Instance instance = {
+				{command->data.quad.x + command->data.quad.width * 0.5f, command->data.quad.y + command->data.quad.height * 0.5f},
+				{command->data.quad.width, command->data.quad.height},
+				{0, 0, 65535, 65535},
+				0,
+				command->data.quad.color
+			};
+			batch_add(command->texture, &instance);
+		} break;
+		case RC_CIRCLE:
+			if (state->circle_count == MAX_BATCH_CIRCLES)
+				circle_batch_flush();
+			state->circle_instance_array[state->circle_count++] = command->data.circle;
+			break;
+		case RC_SEGMENT: {
+			if (state->line_vertex_count == MAX_BATCH_LINES * 2)
+				line_batch_flush();
+			Line_Vertex *vertex = &state->line_vertex_array[state->line_vertex_count];
+			f32 *line_start = command->data.segment.start;
+			f32 *line_end = command->data.segment.end;
+			vertex[0] = (Line_Vertex){{line_start[0], line_start[1]}, command->data.segment.color};
+			vertex[1] = (Line_Vertex){{line_end[0], line_end[1]}, command->data.segment.color};
+			state->line_vertex_count += 2;
+		} break;
+		case RC_TEXT:
+			text_execute(frame, command);
+			break;
+		default:
+			break;
+		}
+	}
+
+	batches_flush();
+	if (is_wireframe)
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+}
+
+// Draws a cached layer's texture over the frame in one quad. The texture
+// holds premultiplied colour.
+static void layer_composite(Render_Frame *frame, u32 layer) {
+	mat2x3 transform;
+	mat2x3_transform(transform, WIDTH * 0.5f, HEIGHT * 0.5f, 0, WIDTH, HEIGHT);
+	mat4x4 model;
+	mat2x3_to_mat4x4(model, transform);
+
+	bind_program(state->shader);
+	if (!(state->world_layer_mask & (1u << layer)))
+		glUniformMatrix4fv(uniform_location(UNIFORM_PROJECTION), 1, GL_FALSE, &state->screen_projection[0][0]);
+	glUniformMatrix4fv(uniform_location(UNIFORM_MODEL), 1, GL_FALSE, &model[0][0]);
+	glUniform4fv(uniform_location(UNIFORM_COLOR), 1, (vec4){1, 1, 1, 1});
+
+	bind_texture(state->layer_texture_array[layer]);
+	bind_vao(state->quad_vao);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	++state->stats.draw_calls;
+
+	glUniformMatrix4fv(uniform_location(UNIFORM_PROJECTION), 1, GL_FALSE, &frame->projection[0][0]);
+}
+
+// Reads back the timers from the last time this ring slot was used. If
+// one still isn't ready it's skipped rather than stalling on the GPU.
+static void gpu_timers_read() {
+	u32 frame = state->gpu_query_frame;
+	u32 issued = state->gpu_query_issued_array[frame];
+
+	for (u32 pass = 0; pass < GPU_TIMER_PASSES; ++pass) {
+		if (!(issued & (1u << pass)))
+			continue;
+
+		u32 query = state->gpu_query_array[frame][pass];
+		GLint is_available = 0;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &is_available);
+		if (!is_available)
+			continue;
+
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+		state->stats.gpu_ms[pass] = nanoseconds / 1000000.0;
+	}
+
+	state->gpu_query_issued_array[frame] = 0;
+}
+
+static void gpu_timer_begin(u32 pass) {
+	u32 frame = state->gpu_query_frame;
+	glBeginQuery(GL_TIME_ELAPSED, state->gpu_query_array[frame][pass]);
+	state->gpu_query_issued_array[frame] |= 1u << pass;
+}
+
+static void gpu_timer_end() {
+	glEndQuery(GL_TIME_ELAPSED);
+}
+
+static void frame_execute(Render_Frame *frame, Render_Sort_Entry *sorted) {
+	gpu_timers_read();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, state->frame_buffer);
+	glClearColor(0.0, 0.7, 0.9, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	projection_upload(frame->projection);
+
+	// Commands are sorted by layer first, so each layer is one run.
+	u32 end = 0;
+	for (u32 layer = 0; end < frame->command_count || layer < MAX_CACHED_LAYERS; ++layer) {
+		u32 start = end;
+		while (end < frame->command_count && sorted[end].key >> 56 == layer)
+			++end;
+
+		u32 bit = layer < MAX_CACHED_LAYERS ? 1u << layer : 0;
+		u8 is_cached = (state->cached_layer_mask & bit) != 0;
+		if (start == end && !is_cached)
+			continue;
+
+		// Layers past the cacheable ones are rare enough to go untimed.
+		if (bit)
+			gpu_timer_begin(layer);
+
+		if (!is_cached) {
+			commands_execute(frame, sorted, start, end);
+			if (bit)
+				gpu_timer_end();
+			continue;
+		}
+
+		// Cached layers are drawn without the screen shake, so the whole
+		// texture can be moved instead. Blending alpha separately leaves
+		// premultiplied colour in the texture.
+		if (frame->redraw_layer_mask & bit) {
+			glBindFramebuffer(GL_FRAMEBUFFER, state->layer_frame_buffer_array[layer]);
+			glClearColor(0, 0, 0, 0);
+			glClear(GL_COLOR_BUFFER_BIT);
+			projection_upload(state->screen_projection);
+			glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+			commands_execute(frame, sorted, start, end);
+
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			glBindFramebuffer(GL_FRAMEBUFFER, state->frame_buffer);
+			projection_upload(frame->projection);
+		}
+
+		layer_composite(frame, layer);
+		gpu_timer_end();
+	}
+
+	if (frame->debug_vertex_count)
+		lines_draw(frame->debug_vertex_array, frame->debug_vertex_count);
+
+	gpu_timer_begin(GPU_TIMER_PASSES - 1);
+	frame_blit(frame);
+	gpu_timer_end();
+
+	state->gpu_query_frame = (state->gpu_query_frame + 1) % GPU_TIMER_FRAMES;
+}
+
+// How each format is handed to glTexImage2D.
+static const GLenum texture_upload_array[TF_COUNT][3] = {
+	[TF_RGBA8] = {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE},
+	[TF_RGBA4] = {GL_RGBA4, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4},
+	[TF_R8] = {GL_R8, GL_RED, GL_UNSIGNED_BYTE},
+};
+
+// The software rasteriser only samples RGBA8.
+static u8 *texture_pixels_expand(u32 format, const u8 *pixels, u32 count) {
+	u8 *rgba = malloc(count * 4);
+
+	for (u32 i = 0; i < count; ++i) {
+		u8 *out = &rgba[i * 4];
+		if (format == TF_RGBA4) {
+			u16 texel = ((const u16 *)pixels)[i];
+			out[0] = (texel >> 12) * 17;
+			out[1] = (texel >> 8 & 0xf) * 17;
+			out[2] = (texel >> 4 & 0xf) * 17;
+			out[3] = (texel & 0xf) * 17;
+		} else if (format == TF_R8) {
+			out[0] = out[1] = out[2] = 255;
+			out[3] = pixels[i];
+		} else {
+			memcpy(out, &pixels[i * 4], 4);
+		}
+	}
+
+	return rgba;
+}
+
+// Maps a baked texture file (see tools/texture_bake.c) and uploads the
+// pixels straight from it. Each region becomes a Texture sharing the one
+// upload.
+static void texture_file_load(const char *path, u32 count, Texture *texture_array) {
+	size_t file_size;
+	u8 *file = io_file_map(path, &file_size);
+	if (!file) {
+		error_and_exit(EXIT_FAILURE, "Could not load texture, run `make textures`.");
+	}
+
+	Texture_File_Header *header = (Texture_File_Header *)file;
+	size_t pixels_offset = sizeof(Texture_File_Header) + count * sizeof(Texture_File_Region);
+	if (file_size < sizeof(Texture_File_Header)
+	    || header->magic != TEXTURE_FILE_MAGIC
+	    || header->format >= TF_COUNT
+	    || header->region_count != count
+	    || file_size < pixels_offset + (size_t)header->width * header->height * texture_format_pixel_size(header->format)) {
+		error_and_exit(EXIT_FAILURE, "Texture file is out of date, run `make textures`.");
+	}
+
+	Texture_File_Region *region_array = (Texture_File_Region *)(file + sizeof(Texture_File_Header));
+	u8 *pixels = file + pixels_offset;
+	i32 width = header->width;
+	i32 height = header->height;
+
+	u32 id;
+	if (state->is_headless) {
+		u8 *rgba = texture_pixels_expand(header->format, pixels, width * height);
+		id = render_soft_texture_create(rgba, width, height, 4);
+		free(rgba);
+	} else {
+		const GLenum *upload = texture_upload_array[header->format];
+		glGenTextures(1, &id);
+		texture_setup(id);
+		glTexImage2D(GL_TEXTURE_2D, 0, upload[0], width, height, 0, upload[1], upload[2], pixels);
+		if (header->format == TF_R8) {
+			glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, (GLint[]){GL_ONE, GL_ONE, GL_ONE, GL_RED});
+		}
+	}
+
+	for (u32 i = 0; i < count; ++i) {
+		Texture_File_Region *region = &region_array[i];
+		Texture *texture = &texture_array[i];
+		texture->id = id;
+		texture->width = region->width;
+		texture->height = region->height;
+		texture->channel_count = header->format == TF_R8 ? 1 : 4;
+		texture->uv_rect[0] = (f32)region->x / width;
+		texture->uv_rect[1] = (f32)region->y / height;
+		texture->uv_rect[2] = (f32)(region->x + region->width) / width;
+		texture->uv_rect[3] = (f32)(region->y + region->height) / height;
+	}
+
+	io_file_unmap(file, file_size);
 }
 
 Texture render_texture_create(const char *path) {
 	Texture texture = {0};
-	glGenTextures(1, &texture.id);
-	texture_setup(texture.id);
-	u8 *image_data = stbi_load(path, &texture.width, &texture.height, &texture.channel_count, 0);
-	if (!image_data) {
-		error_and_exit(EXIT_FAILURE, "Failed to load image\n");
-	}
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture.width, texture.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image_data);
-	stbi_image_free(image_data);
+	texture_file_load(path, 1, &texture);
 	return texture;
 }
+
+void render_atlas_load(const char *path, u32 count, Texture *texture_array) {
+	texture_file_load(path, count, texture_array);
+}
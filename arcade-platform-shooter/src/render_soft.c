@@ -0,0 +1,550 @@
+#include "shared.h"
+#include <math.h>
+#include "./engine/io.h"
+
+Render_Soft_State render_soft_state = {0};
+static Render_Soft_State *state = &render_soft_state;
+
+extern Render_State render_state;
+
+// Software rasteriser. Executes the same sorted command list as the GL
+// path into a WIDTH x HEIGHT buffer in memory, for machines without a GL
+// driver and for comparing frames against golden images. The buffer is
+// split into tiles and each worker thread rasterises every command into
+// its own tiles, so the result does not depend on the thread count.
+//
+// Rows are stored bottom first, like GL, and pixels are packed the same
+// way as color_pack.
+
+#define SOFT_TILE_COLUMNS ((WIDTH + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE)
+#define SOFT_TILE_ROWS ((HEIGHT + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE)
+
+// FreeType's default distance field spread, in texels.
+#define SOFT_SDF_SPREAD 8
+
+typedef struct soft_rect {
+	i32 x0;
+	i32 y0;
+	i32 x1;
+	i32 y1;
+} Soft_Rect;
+
+// Maps world or text coordinates to pixels. Both projections are
+// orthographic, so a scale and offset per axis is all there is.
+typedef struct soft_transform {
+	f32 scale[2];
+	f32 offset[2];
+} Soft_Transform;
+
+static i32 clampi(i32 value, i32 min, i32 max) {
+	return value < min ? min : value > max ? max : value;
+}
+
+static f32 smoothstep(f32 edge0, f32 edge1, f32 x) {
+	f32 t = (x - edge0) / (edge1 - edge0);
+	t = t < 0 ? 0 : t > 1 ? 1 : t;
+	return t * t * (3 - 2 * t);
+}
+
+// Source over destination with 8 bit alpha. Dividing by 255 as
+// (t + (t >> 8)) >> 8 is exact for these ranges and matches the SIMD path.
+static u32 channel_blend(u32 destination, u32 source, u32 alpha) {
+	u32 t = source * alpha + destination * (255 - alpha) + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+static void pixel_blend(u32 *pixel, u32 color, u32 alpha) {
+	u32 result = 0;
+	for (u32 i = 0; i < 32; i += 8) {
+		result |= channel_blend((*pixel >> i) & 0xff, (color >> i) & 0xff, alpha) << i;
+	}
+	*pixel = result;
+}
+
+// Multiplies two packed colours channel by channel.
+static u32 color_modulate(u32 a, u32 b) {
+	u32 result = 0;
+	for (u32 i = 0; i < 32; i += 8) {
+		result |= ((((a >> i) & 0xff) * ((b >> i) & 0xff) + 127) / 255) << i;
+	}
+	return result;
+}
+
+static void span_fill(u32 *row, i32 count, u32 color) {
+	i32 i = 0;
+#if HAS_SSE2
+	__m128i value = _mm_set1_epi32((i32)color);
+	for (; i + 4 <= count; i += 4) {
+		_mm_storeu_si128((__m128i *)&row[i], value);
+	}
+#endif
+	for (; i < count; ++i) {
+		row[i] = color;
+	}
+}
+
+// Blends one colour over a run of pixels, four at a time with SSE2.
+static void span_blend(u32 *row, i32 count, u32 color) {
+	u32 alpha = color >> 24;
+	if (alpha == 0)
+		return;
+	if (alpha == 255) {
+		span_fill(row, count, color);
+		return;
+	}
+
+	i32 i = 0;
+#if HAS_SSE2
+	__m128i zero = _mm_setzero_si128();
+	__m128i source = _mm_unpacklo_epi8(_mm_set1_epi32((i32)color), zero);
+	__m128i source_term = _mm_add_epi16(_mm_mullo_epi16(source, _mm_set1_epi16((short)alpha)), _mm_set1_epi16(128));
+	__m128i inverse_alpha = _mm_set1_epi16((short)(255 - alpha));
+	for (; i + 4 <= count; i += 4) {
+		__m128i destination = _mm_loadu_si128((__m128i *)&row[i]);
+		__m128i low = _mm_unpacklo_epi8(destination, zero);
+		__m128i high = _mm_unpackhi_epi8(destination, zero);
+		low = _mm_add_epi16(_mm_mullo_epi16(low, inverse_alpha), source_term);
+		high = _mm_add_epi16(_mm_mullo_epi16(high, inverse_alpha), source_term);
+		low = _mm_srli_epi16(_mm_add_epi16(low, _mm_srli_epi16(low, 8)), 8);
+		high = _mm_srli_epi16(_mm_add_epi16(high, _mm_srli_epi16(high, 8)), 8);
+		_mm_storeu_si128((__m128i *)&row[i], _mm_packus_epi16(low, high));
+	}
+#endif
+	for (; i < count; ++i) {
+		pixel_blend(&row[i], color, alpha);
+	}
+}
+
+// Fills pixels whose centres are inside the rectangle, like GL.
+static void quad_fill(const Soft_Rect *clip, f32 x0, f32 y0, f32 x1, f32 y1, u32 color) {
+	i32 px0 = clampi((i32)ceilf(x0 - 0.5f), clip->x0, clip->x1);
+	i32 px1 = clampi((i32)ceilf(x1 - 0.5f), clip->x0, clip->x1);
+	i32 py0 = clampi((i32)ceilf(y0 - 0.5f), clip->y0, clip->y1);
+	i32 py1 = clampi((i32)ceilf(y1 - 0.5f), clip->y0, clip->y1);
+
+	for (i32 y = py0; y < py1; ++y) {
+		span_blend(&state->pixels[y * WIDTH + px0], px1 - px0, color);
+	}
+}
+
+static void segment_draw(const Soft_Rect *clip, f32 x0, f32 y0, f32 x1, f32 y1, u32 color) {
+	f32 dx = x1 - x0;
+	f32 dy = y1 - y0;
+	i32 steps = (i32)ceilf(fmaxf(fabsf(dx), fabsf(dy)));
+	if (steps < 1)
+		steps = 1;
+
+	for (i32 i = 0; i <= steps; ++i) {
+		i32 x = (i32)floorf(x0 + dx * i / steps);
+		i32 y = (i32)floorf(y0 + dy * i / steps);
+		if (x >= clip->x0 && x < clip->x1 && y >= clip->y0 && y < clip->y1)
+			pixel_blend(&state->pixels[y * WIDTH + x], color, color >> 24);
+	}
+}
+
+static void circle_draw(const Soft_Rect *clip, const Circle_Instance *circle, const Soft_Transform *transform) {
+	f32 cx = circle->position[0] * transform->scale[0] + transform->offset[0];
+	f32 cy = circle->position[1] * transform->scale[1] + transform->offset[1];
+	f32 radius = circle->radius * transform->scale[0];
+	f32 thickness = circle->thickness * transform->scale[0];
+	f32 alpha = (circle->color >> 24) / 255.0f;
+
+	i32 px0 = clampi((i32)floorf(cx - radius - 1), clip->x0, clip->x1);
+	i32 px1 = clampi((i32)ceilf(cx + radius + 1), clip->x0, clip->x1);
+	i32 py0 = clampi((i32)floorf(cy - radius - 1), clip->y0, clip->y1);
+	i32 py1 = clampi((i32)ceilf(cy + radius + 1), clip->y0, clip->y1);
+
+	// Same distance as circle.frag, with the edge faded over a pixel.
+	for (i32 y = py0; y < py1; ++y) {
+		for (i32 x = px0; x < px1; ++x) {
+			f32 dx = x + 0.5f - cx;
+			f32 dy = y + 0.5f - cy;
+			f32 d = sqrtf(dx * dx + dy * dy);
+			f32 ring = fabsf(d - (radius - thickness * 0.5f)) - thickness * 0.5f;
+			f32 coverage = 1 - smoothstep(-1, 1, ring);
+			if (coverage > 0)
+				pixel_blend(&state->pixels[y * WIDTH + x], circle->color, (u32)(coverage * alpha * 255 + 0.5f));
+		}
+	}
+}
+
+static void sprite_draw(const Soft_Rect *clip, const Soft_Sprite *prepared, const Sprite_Instance *sprite, const Soft_Texture *texture) {
+	const f32 *m = prepared->inverse;
+	i32 px0 = clampi(prepared->bounds[0], clip->x0, clip->x1);
+	i32 py0 = clampi(prepared->bounds[1], clip->y0, clip->y1);
+	i32 px1 = clampi(prepared->bounds[2], clip->x0, clip->x1);
+	i32 py1 = clampi(prepared->bounds[3], clip->y0, clip->y1);
+
+	f32 u0 = sprite->uv_rect[0] / 65535.0f;
+	f32 v0 = sprite->uv_rect[1] / 65535.0f;
+	f32 u1 = sprite->uv_rect[2] / 65535.0f;
+	f32 v1 = sprite->uv_rect[3] / 65535.0f;
+
+	for (i32 y = py0; y < py1; ++y) {
+		f32 u = m[0] * px0 + m[1] * y + m[2];
+		f32 v = m[3] * px0 + m[4] * y + m[5];
+		for (i32 x = px0; x < px1; ++x, u += m[0], v += m[3]) {
+			if (u < 0 || u >= 1 || v < 0 || v >= 1)
+				continue;
+
+			i32 tx = clampi((i32)((u0 + (u1 - u0) * u) * texture->width), 0, texture->width - 1);
+			i32 ty = clampi((i32)((v0 + (v1 - v0) * v) * texture->height), 0, texture->height - 1);
+			u32 color = color_modulate(texture->pixels[ty * texture->width + tx], sprite->color);
+			if (color >> 24)
+				pixel_blend(&state->pixels[y * WIDTH + x], color, color >> 24);
+		}
+	}
+}
+
+// Works out up to four sprites at once. The inverse undoes the rotation
+// in batch.vert, taking a pixel centre to (u, v), and a negative width
+// flips u.
+static void sprites_prepare_4(Render_Frame *frame, const Soft_Transform *world, const u32 *index_array, u32 count) {
+	f32 position_x[4], position_y[4], size_x[4], size_y[4], sine[4], cosine[4];
+
+	for (u32 i = 0; i < 4; ++i) {
+		// Short batches repeat the last sprite.
+		const Sprite_Instance *sprite = &frame->command_array[index_array[i < count ? i : count - 1]].data.sprite;
+		position_x[i] = sprite->position[0];
+		position_y[i] = sprite->position[1];
+		size_x[i] = sprite->size[0];
+		size_y[i] = sprite->size[1];
+		sine[i] = 0;
+		cosine[i] = 1;
+		if (sprite->rotation != 0)
+			sincos_lut(sprite->rotation, &sine[i], &cosine[i]);
+	}
+
+	f32 cx[4], cy[4], extent_x[4], extent_y[4];
+	f32 m0[4], m1[4], m2[4], m3[4], m4[4], m5[4];
+
+#if HAS_SSE2
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 sign = _mm_set1_ps(-0.0f);
+	__m128 s = _mm_loadu_ps(sine);
+	__m128 c = _mm_loadu_ps(cosine);
+	__m128 x = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(position_x), _mm_set1_ps(world->scale[0])), _mm_set1_ps(world->offset[0]));
+	__m128 y = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(position_y), _mm_set1_ps(world->scale[1])), _mm_set1_ps(world->offset[1]));
+	__m128 w = _mm_mul_ps(_mm_loadu_ps(size_x), _mm_set1_ps(world->scale[0]));
+	__m128 h = _mm_mul_ps(_mm_loadu_ps(size_y), _mm_set1_ps(world->scale[1]));
+
+	// Bounds of the rotated quad.
+	__m128 ex = _mm_add_ps(_mm_andnot_ps(sign, _mm_mul_ps(w, c)), _mm_andnot_ps(sign, _mm_mul_ps(h, s)));
+	__m128 ey = _mm_add_ps(_mm_andnot_ps(sign, _mm_mul_ps(w, s)), _mm_andnot_ps(sign, _mm_mul_ps(h, c)));
+	_mm_storeu_ps(extent_x, _mm_mul_ps(ex, half));
+	_mm_storeu_ps(extent_y, _mm_mul_ps(ey, half));
+	_mm_storeu_ps(cx, x);
+	_mm_storeu_ps(cy, y);
+
+	__m128 iw = _mm_div_ps(_mm_set1_ps(1), w);
+	__m128 ih = _mm_div_ps(_mm_set1_ps(1), h);
+	__m128 a = _mm_mul_ps(c, iw);
+	__m128 b = _mm_mul_ps(s, iw);
+	__m128 d = _mm_mul_ps(_mm_xor_ps(s, sign), ih);
+	__m128 e = _mm_mul_ps(c, ih);
+	__m128 hx = _mm_sub_ps(half, x);
+	__m128 hy = _mm_sub_ps(half, y);
+	_mm_storeu_ps(m0, a);
+	_mm_storeu_ps(m1, b);
+	_mm_storeu_ps(m2, _mm_add_ps(half, _mm_add_ps(_mm_mul_ps(a, hx), _mm_mul_ps(b, hy))));
+	_mm_storeu_ps(m3, d);
+	_mm_storeu_ps(m4, e);
+	_mm_storeu_ps(m5, _mm_add_ps(half, _mm_add_ps(_mm_mul_ps(d, hx), _mm_mul_ps(e, hy))));
+#else
+	for (u32 i = 0; i < 4; ++i) {
+		f32 s = sine[i];
+		f32 c = cosine[i];
+		f32 w = size_x[i] * world->scale[0];
+		f32 h = size_y[i] * world->scale[1];
+		cx[i] = position_x[i] * world->scale[0] + world->offset[0];
+		cy[i] = position_y[i] * world->scale[1] + world->offset[1];
+		extent_x[i] = (fabsf(w * c) + fabsf(h * s)) * 0.5f;
+		extent_y[i] = (fabsf(w * s) + fabsf(h * c)) * 0.5f;
+
+		m0[i] = c * (1 / w);
+		m1[i] = s * (1 / w);
+		m3[i] = -s * (1 / h);
+		m4[i] = c * (1 / h);
+		m2[i] = 0.5f + (m0[i] * (0.5f - cx[i]) + m1[i] * (0.5f - cy[i]));
+		m5[i] = 0.5f + (m3[i] * (0.5f - cx[i]) + m4[i] * (0.5f - cy[i]));
+	}
+#endif
+
+	for (u32 i = 0; i < count; ++i) {
+		Soft_Sprite *prepared = &state->sprite_array[index_array[i]];
+		prepared->inverse[0] = m0[i];
+		prepared->inverse[1] = m1[i];
+		prepared->inverse[2] = m2[i];
+		prepared->inverse[3] = m3[i];
+		prepared->inverse[4] = m4[i];
+		prepared->inverse[5] = m5[i];
+		prepared->bounds[0] = (i32)floorf(cx[i] - extent_x[i]);
+		prepared->bounds[1] = (i32)floorf(cy[i] - extent_y[i]);
+		prepared->bounds[2] = (i32)ceilf(cx[i] + extent_x[i]);
+		prepared->bounds[3] = (i32)ceilf(cy[i] + extent_y[i]);
+	}
+}
+
+// Done once before the tiles start, rather than again in every tile the
+// sprite might touch.
+static void sprites_prepare(Render_Frame *frame, const Soft_Transform *world) {
+	u32 index_array[4];
+	u32 count = 0;
+
+	for (u32 i = 0; i < frame->command_count; ++i) {
+		if (frame->command_array[i].type != RC_SPRITE)
+			continue;
+		index_array[count++] = i;
+		if (count == 4) {
+			sprites_prepare_4(frame, world, index_array, count);
+			count = 0;
+		}
+	}
+
+	if (count)
+		sprites_prepare_4(frame, world, index_array, count);
+}
+
+// Bilinear sample of a single channel texture, 0 to 1.
+static f32 texture_sample_red(const Soft_Texture *texture, f32 u, f32 v) {
+	f32 x = u * texture->width - 0.5f;
+	f32 y = v * texture->height - 0.5f;
+	i32 x0 = (i32)floorf(x);
+	i32 y0 = (i32)floorf(y);
+	f32 fx = x - x0;
+	f32 fy = y - y0;
+
+	f32 texel_array[4];
+	for (u32 i = 0; i < 4; ++i) {
+		i32 tx = clampi(x0 + (i & 1), 0, texture->width - 1);
+		i32 ty = clampi(y0 + (i >> 1), 0, texture->height - 1);
+		texel_array[i] = (texture->pixels[ty * texture->width + tx] & 0xff) / 255.0f;
+	}
+
+	f32 top = texel_array[0] + (texel_array[1] - texel_array[0]) * fx;
+	f32 bottom = texel_array[2] + (texel_array[3] - texel_array[2]) * fx;
+	return top + (bottom - top) * fy;
+}
+
+static void text_draw(const Soft_Rect *clip, Render_Frame *frame, Render_Command *command) {
+	const Character_Data *character_data_array = render_state.character_data_array;
+	const Soft_Texture *texture = &state->texture_array[command->texture - 1];
+	const char *text = &frame->text_array[command->data.text.offset];
+	u32 length = command->data.text.length;
+
+	// Laid out exactly as in render.c's text_execute.
+	f32 scale = command->data.text.size / FONT_SDF_SIZE;
+	f32 x = command->data.text.x;
+	f32 y = command->data.text.y;
+
+	if (command->data.text.is_centered) {
+		f32 width = 0;
+		for (u32 i = 0; i < length; ++i) {
+			width += (character_data_array[(u32)text[i] & 127].advance_x / 64) * scale;
+		}
+		x -= width * 0.5;
+	}
+
+	// How far the distance moves across one pixel, as fwidth in text.frag.
+	f32 edge = 0.5f / (scale * SOFT_SDF_SPREAD);
+	u32 color_alpha = command->data.text.color >> 24;
+
+	for (u32 i = 0; i < length; ++i) {
+		Character_Data cd = character_data_array[(u32)text[i] & 127];
+
+		f32 x2 = x + cd.left * scale;
+		f32 y2 = y - (cd.height - cd.top) * scale;
+		f32 w = cd.width * scale;
+		f32 h = cd.height * scale;
+		x += (cd.advance_x / 64) * scale;
+
+		if (w <= 0 || h <= 0)
+			continue;
+
+		i32 px0 = clampi((i32)ceilf(x2 - 0.5f), clip->x0, clip->x1);
+		i32 px1 = clampi((i32)ceilf(x2 + w - 0.5f), clip->x0, clip->x1);
+		i32 py0 = clampi((i32)ceilf(y2 - 0.5f), clip->y0, clip->y1);
+		i32 py1 = clampi((i32)ceilf(y2 + h - 0.5f), clip->y0, clip->y1);
+
+		for (i32 py = py0; py < py1; ++py) {
+			// The glyph's top row (v0) is at the top of the quad.
+			f32 v = cd.uv_rect[3] + (cd.uv_rect[1] - cd.uv_rect[3]) * ((py + 0.5f - y2) / h);
+			for (i32 px = px0; px < px1; ++px) {
+				f32 u = cd.uv_rect[0] + (cd.uv_rect[2] - cd.uv_rect[0]) * ((px + 0.5f - x2) / w);
+				f32 coverage = smoothstep(0.5f - edge, 0.5f + edge, texture_sample_red(texture, u, v));
+				u32 alpha = (u32)(coverage * color_alpha + 0.5f);
+				if (alpha)
+					pixel_blend(&state->pixels[py * WIDTH + px], command->data.text.color, alpha);
+			}
+		}
+	}
+}
+
+static void world_transform_get(Render_Frame *frame, Soft_Transform *world) {
+	world->scale[0] = frame->projection[0][0] * WIDTH * 0.5f;
+	world->scale[1] = frame->projection[1][1] * HEIGHT * 0.5f;
+	world->offset[0] = (frame->projection[3][0] + 1) * WIDTH * 0.5f;
+	world->offset[1] = (frame->projection[3][1] + 1) * HEIGHT * 0.5f;
+}
+
+static void tile_execute(u32 tile) {
+	Render_Frame *frame = state->frame;
+	Soft_Rect clip;
+	clip.x0 = (tile % SOFT_TILE_COLUMNS) * SOFT_TILE_SIZE;
+	clip.y0 = (tile / SOFT_TILE_COLUMNS) * SOFT_TILE_SIZE;
+	clip.x1 = clip.x0 + SOFT_TILE_SIZE < WIDTH ? clip.x0 + SOFT_TILE_SIZE : WIDTH;
+	clip.y1 = clip.y0 + SOFT_TILE_SIZE < HEIGHT ? clip.y0 + SOFT_TILE_SIZE : HEIGHT;
+
+	Soft_Transform world;
+	world_transform_get(frame, &world);
+
+	u32 clear_color = color_pack((vec4){0.0, 0.7, 0.9, 1});
+	for (i32 y = clip.y0; y < clip.y1; ++y) {
+		span_fill(&state->pixels[y * WIDTH + clip.x0], clip.x1 - clip.x0, clear_color);
+	}
+
+	for (u32 i = 0; i < frame->command_count; ++i) {
+		u32 index = state->sorted[i].index;
+		Render_Command *command = &frame->command_array[index];
+
+		switch (command->type) {
+		case RC_SPRITE:
+			sprite_draw(&clip, &state->sprite_array[index], &command->data.sprite, &state->texture_array[command->texture - 1]);
+			break;
+		case RC_QUAD: {
+			f32 x0 = command->data.quad.x * world.scale[0] + world.offset[0];
+			f32 y0 = command->data.quad.y * world.scale[1] + world.offset[1];
+			f32 x1 = x0 + command->data.quad.width * world.scale[0];
+			f32 y1 = y0 + command->data.quad.height * world.scale[1];
+			u32 color = command->data.quad.color;
+			if (command->is_wireframe) {
+				segment_draw(&clip, x0, y0, x1, y0, color);
+				segment_draw(&clip, x1, y0, x1, y1, color);
+				segment_draw(&clip, x1, y1, x0, y1, color);
+				segment_draw(&clip, x0, y1, x0, y0, color);
+			} else {
+				quad_fill(&clip, x0, y0, x1, y1, color);
+			}
+		} break;
+		case RC_SEGMENT: {
+			f32 *start = command->data.segment.start;
+			f32 *end = command->data.segment.end;
+			segment_draw(&clip,
+				start[0] * world.scale[0] + world.offset[0], start[1] * world.scale[1] + world.offset[1],
+				end[0] * world.scale[0] + world.offset[0], end[1] * world.scale[1] + world.offset[1],
+				command->data.segment.color);
+		} break;
+		case RC_CIRCLE:
+			circle_draw(&clip, &command->data.circle, &world);
+			break;
+		case RC_TEXT:
+			text_draw(&clip, frame, command);
+			break;
+		default:
+			break;
+		}
+	}
+
+	for (u32 i = 0; i < frame->debug_vertex_count; i += 2) {
+		Line_Vertex *vertex = &frame->debug_vertex_array[i];
+		segment_draw(&clip,
+			vertex[0].position[0] * world.scale[0] + world.offset[0], vertex[0].position[1] * world.scale[1] + world.offset[1],
+			vertex[1].position[0] * world.scale[0] + world.offset[0], vertex[1].position[1] * world.scale[1] + world.offset[1],
+			vertex[0].color);
+	}
+}
+
+static int render_soft_worker(void *data) {
+	u32 index = (u32)(uintptr_t)data;
+
+	for (;;) {
+		SDL_SemWait(state->start_array[index]);
+		for (u32 tile = index; tile < SOFT_TILE_COLUMNS * SOFT_TILE_ROWS; tile += state->thread_count) {
+			tile_execute(tile);
+		}
+		SDL_SemPost(state->done);
+	}
+
+	return 0;
+}
+
+void render_soft_setup() {
+	state->pixels = calloc(WIDTH * HEIGHT, sizeof(u32));
+	state->sprite_array = malloc(MAX_RENDER_COMMANDS * sizeof(Soft_Sprite));
+
+	i32 cpu_count = SDL_GetCPUCount();
+	state->thread_count = cpu_count < 1 ? 1 : cpu_count > MAX_SOFT_THREADS ? MAX_SOFT_THREADS : cpu_count;
+	state->done = SDL_CreateSemaphore(0);
+	for (u32 i = 0; i < state->thread_count; ++i) {
+		state->start_array[i] = SDL_CreateSemaphore(0);
+		state->thread_array[i] = SDL_CreateThread(render_soft_worker, "render_soft", (void *)(uintptr_t)i);
+		if (state->thread_array[i] == NULL) {
+			error_and_exit(EXIT_FAILURE, "Failed to start software render thread");
+		}
+	}
+}
+
+// Copies the image as RGBA. Single channel images are spread to every
+// channel, text only reads the first.
+u32 render_soft_texture_create(const u8 *pixels, i32 width, i32 height, i32 channel_count) {
+	if (state->texture_count == MAX_SOFT_TEXTURES) {
+		error_and_exit(EXIT_FAILURE, "No software textures left.");
+	}
+
+	Soft_Texture *texture = &state->texture_array[state->texture_count++];
+	texture->pixels = malloc(width * height * sizeof(u32));
+	texture->width = width;
+	texture->height = height;
+
+	for (i32 i = 0; i < width * height; ++i) {
+		const u8 *texel = &pixels[i * channel_count];
+		if (channel_count == 1) {
+			texture->pixels[i] = texel[0] * 0x01010101u;
+		} else {
+			texture->pixels[i] = texel[0] | texel[1] << 8 | texel[2] << 16 | (u32)(channel_count == 4 ? texel[3] : 255) << 24;
+		}
+	}
+
+	// Ids start at one so zero still means no texture.
+	return state->texture_count;
+}
+
+void render_soft_execute(Render_Frame *frame, Render_Sort_Entry *sorted) {
+	state->frame = frame;
+	state->sorted = sorted;
+
+	Soft_Transform world;
+	world_transform_get(frame, &world);
+	sprites_prepare(frame, &world);
+
+	for (u32 i = 0; i < state->thread_count; ++i) {
+		SDL_SemPost(state->start_array[i]);
+	}
+	for (u32 i = 0; i < state->thread_count; ++i) {
+		SDL_SemWait(state->done);
+	}
+}
+
+// Writes the last executed frame as a binary PPM.
+void render_soft_write_ppm(const char *path) {
+	char header[32];
+	i32 header_size = sprintf(header, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
+	size_t size = header_size + WIDTH * HEIGHT * 3;
+	u8 *buffer = malloc(size);
+
+	memcpy(buffer, header, header_size);
+	u8 *rgb = buffer + header_size;
+	for (i32 y = HEIGHT - 1; y >= 0; --y) {
+		for (i32 x = 0; x < WIDTH; ++x) {
+			u32 pixel = state->pixels[y * WIDTH + x];
+			*rgb++ = pixel & 0xff;
+			*rgb++ = (pixel >> 8) & 0xff;
+			*rgb++ = (pixel >> 16) & 0xff;
+		}
+	}
+
+	if (io_file_write(buffer, size, path)) {
+		error_and_exit(EXIT_FAILURE, "Failed to write frame.");
+	}
+	free(buffer);
+}
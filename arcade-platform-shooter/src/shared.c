@@ -33,3 +33,155 @@ f32 vec2_sqr_dist(vec2 a, vec2 b) {
 	f32 dy = b[1] - a[1];
 	return dx * dx + dy * dy;
 }
+
+u32 color_pack(vec4 color) {
+	u32 packed = 0;
+	for (u32 i = 0; i < 4; ++i) {
+		packed |= (u32)(fclamp(color[i], 0, 1) * 255.0f + 0.5f) << (i * 8);
+	}
+	return packed;
+}
+
+void color_unpack(u32 color, vec4 out) {
+	for (u32 i = 0; i < 4; ++i) {
+		out[i] = ((color >> (i * 8)) & 0xff) / 255.0f;
+	}
+}
+
+// One full turn, plus the first sample again so interpolation never
+// has to wrap.
+static f32 sine_table[SINCOS_TABLE_SIZE + 1];
+
+void sincos_setup() {
+	for (u32 i = 0; i <= SINCOS_TABLE_SIZE; ++i) {
+		sine_table[i] = (f32)sin(i * 2 * 3.14159265358979 / SINCOS_TABLE_SIZE);
+	}
+}
+
+// Interpolated table lookup, off by at most about 5e-6. No rotation
+// comes out exact.
+void sincos_lut(f32 angle, f32 *s, f32 *c) {
+	f32 t = angle * (f32)(SINCOS_TABLE_SIZE / (2 * PI));
+	f32 whole = floorf(t);
+	f32 fraction = t - whole;
+	u32 i = (u32)(i32)whole & (SINCOS_TABLE_SIZE - 1);
+	u32 j = (i + SINCOS_TABLE_SIZE / 4) & (SINCOS_TABLE_SIZE - 1);
+	*s = sine_table[i] + (sine_table[i + 1] - sine_table[i]) * fraction;
+	*c = sine_table[j] + (sine_table[j + 1] - sine_table[j]) * fraction;
+}
+
+// Scale, then rotate, then move to (x, y).
+void mat2x3_transform(mat2x3 m, f32 x, f32 y, f32 rotation, f32 scale_x, f32 scale_y) {
+	f32 s = 0;
+	f32 c = 1;
+	if (rotation != 0)
+		sincos_lut(rotation, &s, &c);
+
+	m[0] = c * scale_x;
+	m[1] = -s * scale_y;
+	m[2] = x;
+	m[3] = s * scale_x;
+	m[4] = c * scale_y;
+	m[5] = y;
+}
+
+// For shaders that still take a full model matrix.
+void mat2x3_to_mat4x4(mat4x4 out, mat2x3 m) {
+	mat4x4_identity(out);
+	out[0][0] = m[0];
+	out[1][0] = m[1];
+	out[3][0] = m[2];
+	out[0][1] = m[3];
+	out[1][1] = m[4];
+	out[3][1] = m[5];
+}
+
+// The original pointer is stashed just before the aligned block so it
+// can be handed back to free().
+void *aligned_calloc(size_t count, size_t size, size_t alignment) {
+	u8 *memory = calloc(1, count * size + alignment + sizeof(void *));
+	if (!memory)
+		return NULL;
+
+	uintptr_t address = (uintptr_t)(memory + sizeof(void *));
+	address = (address + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	((void **)address)[-1] = memory;
+
+	return (void *)address;
+}
+
+void aligned_free(void *memory) {
+	if (memory)
+		free(((void **)memory)[-1]);
+}
+
+// Shelf packing. Images go left to right along a shelf as tall as the
+// first (tallest) image on it. Returns the height used, or 0 if an image
+// is wider than the atlas.
+static i32 shelf_pack(Atlas_Image *image_array, u32 *order, u32 count, i32 width) {
+	i32 x = 0;
+	i32 y = 0;
+	i32 shelf_height = 0;
+
+	for (u32 i = 0; i < count; ++i) {
+		Atlas_Image *image = &image_array[order[i]];
+		i32 padded_width = image->width + ATLAS_PADDING;
+		i32 padded_height = image->height + ATLAS_PADDING;
+
+		if (padded_width > width)
+			return 0;
+
+		if (x + padded_width > width) {
+			y += shelf_height;
+			x = 0;
+			shelf_height = 0;
+		}
+
+		image->x = x;
+		image->y = y;
+		x += padded_width;
+		if (padded_height > shelf_height)
+			shelf_height = padded_height;
+	}
+
+	return y + shelf_height;
+}
+
+// Places every image in the narrowest power of two wide atlas whose
+// height doesn't exceed its width. Returns 0 if that is wider than
+// max_size.
+u8 atlas_pack(Atlas_Image *image_array, u32 count, i32 max_size, i32 *width, i32 *height) {
+	u32 order[MAX_ATLAS_PACK_IMAGES];
+
+	if (count > MAX_ATLAS_PACK_IMAGES)
+		return 0;
+
+	// Tallest first keeps shelves full.
+	for (u32 i = 0; i < count; ++i) {
+		u32 j = i;
+		for (; j > 0 && image_array[order[j - 1]].height < image_array[i].height; --j)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	for (*width = 256; *width <= max_size; *width *= 2) {
+		*height = shelf_pack(image_array, order, count, *width);
+		if (*height != 0 && *height <= *width)
+			return 1;
+	}
+
+	return 0;
+}
+
+u32 texture_format_pixel_size(u32 format) {
+	switch (format) {
+	case TF_RGBA8:
+		return 4;
+	case TF_RGBA4:
+		return 2;
+	case TF_R8:
+		return 1;
+	default:
+		return 0;
+	}
+}
@@ -13,6 +13,13 @@
 
 #include "../deps/lib/linmath.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAS_SSE2 1
+#include <emmintrin.h>
+#else
+#define HAS_SSE2 0
+#endif
+
 ////////////////////////////////////////////////////////////////////////
 // Defined types.
 ////////////////////////////////////////////////////////////////////////
@@ -20,6 +27,7 @@
 #define u8 uint8_t
 #define u16 uint16_t
 #define u32 uint32_t
+#define u64 uint64_t
 #define f32 float
 #define f64 double
 #define i8 int8_t
@@ -31,10 +39,15 @@
 
 #define DEBUG 0
 
+// Execute render commands on a thread of their own, overlapping with the
+// simulation of the next frame.
+#define RENDER_THREAD 1
+
 #define PI 3.14159265
 
 #define GAME_TITLE "Mega Box Crate"
 
+// The game's resolution, and how much the window starts scaled up.
 #define SCALE 4
 #define WIDTH 480
 #define HEIGHT 270
@@ -44,11 +57,48 @@
 #define TERMINAL_VELOCITY -300
 
 #define MAX_ENTITIES 256
+#define MAX_ENTITY_TAGS 32
+#define MAX_ENTITY_TYPES 16
+#define CACHE_LINE_SIZE 64
 #define MAX_STATIC_BODIES 20
 #define MAX_TRIGGERS 10
 #define MAX_SPRITE_SHEETS 10
 #define MAX_SPRITE_ANIMATIONS 20
 #define MAX_SPRITE_ANIMATION_FRAMES 32
+#define MAX_TIMERS 4096
+#define MAX_TWEENS 4096
+#define MAX_PROJECTILES 8192
+#define MAX_PROJECTILE_HITS 1024
+#define MAX_BATCH_SPRITES 8192
+#define MAX_BATCH_CIRCLES 1024
+#define MAX_BATCH_LINES 4096
+#define MAX_DEBUG_LINES 16384
+#define MAX_SHADERS 8
+#define MAX_SHADER_INCLUDE_DEPTH 8
+#define MAX_SHADER_FILES 16
+#define MAX_RENDER_COMMANDS 32768
+#define MAX_RENDER_TEXT 8192
+#define MAX_CACHED_LAYERS 8
+// A timer for each cacheable layer, and one for the upscale.
+#define GPU_TIMER_PASSES (MAX_CACHED_LAYERS + 1)
+#define GPU_TIMER_FRAMES 4
+#define PROFILE_HISTORY 120
+#define MAX_PROFILE_DEPTH 8
+#define STREAM_FRAME_COUNT 3
+#define STREAM_REGION_SIZE (1024 * 1024)
+#define STREAM_FENCE_TIMEOUT 1000000000ull
+#define MAX_ATLAS_IMAGES 16
+#define MAX_ATLAS_SIZE 4096
+#define MAX_ATLAS_PACK_IMAGES 128
+#define ATLAS_PADDING 2
+#define MAX_TEXT_LENGTH 256
+#define FONT_SIZE 12
+#define FONT_SDF_SIZE 32
+#define SPATIAL_GRID_CELL_SIZE 32
+#define TIMER_TICKS_PER_SECOND 1000
+#define TIMER_WHEEL_LEVELS 4
+#define SINCOS_TABLE_SIZE 1024
+#define TIMER_WHEEL_SLOTS 64
 
 ////////////////////////////////////////////////////////////////////////
 // Shared functions.
@@ -62,6 +112,33 @@ f32 frandr(f32 min, f32 max);
 f32 vec2_dist(vec2 a, vec2 b);
 f32 vec2_sqr_dist(vec2 a, vec2 b);
 
+u32 color_pack(vec4 color);
+void color_unpack(u32 color, vec4 out);
+
+void *aligned_calloc(size_t count, size_t size, size_t alignment);
+void aligned_free(void *memory);
+
+// 2D affine transform, stored by rows:
+//     x' = m[0] * x + m[1] * y + m[2]
+//     y' = m[3] * x + m[4] * y + m[5]
+typedef f32 mat2x3[6];
+
+void sincos_setup();
+void sincos_lut(f32 angle, f32 *s, f32 *c);
+void mat2x3_transform(mat2x3 m, f32 x, f32 y, f32 rotation, f32 scale_x, f32 scale_y);
+void mat2x3_to_mat4x4(mat4x4 out, mat2x3 m);
+
+// An image placed by atlas_pack at (x, y).
+typedef struct atlas_image {
+	u8 *pixels;
+	i32 width;
+	i32 height;
+	i32 x;
+	i32 y;
+} Atlas_Image;
+
+u8 atlas_pack(Atlas_Image *image_array, u32 count, i32 max_size, i32 *width, i32 *height);
+
 ////////////////////////////////////////////////////////////////////////
 // Typedefs.
 ////////////////////////////////////////////////////////////////////////
@@ -71,8 +148,10 @@ typedef struct aabb AABB;
 typedef struct static_body Static_Body;
 typedef struct trigger Trigger;
 typedef struct physics_state Physics_State;
+typedef struct spatial_grid Spatial_Grid;
 
 typedef struct entity Entity;
+typedef struct entity_type Entity_Type;
 typedef struct entity_state Entity_State;
 
 typedef struct render_state Render_State;
@@ -81,55 +160,430 @@ typedef struct sprite_sheet Sprite_Sheet;
 
 typedef struct collision Collision;
 
+typedef struct timer Timer;
+typedef struct timer_state Timer_State;
+
+typedef struct tween_state Tween_State;
+
+typedef struct projectile_hit Projectile_Hit;
+typedef struct projectile_state Projectile_State;
+
 typedef void (*On_Collide_Function)(Collision collision);
 typedef void (*On_Collide_Static_Function)(Collision collision);
 typedef void (*On_Trigger_Function)(Collision collision);
+typedef void (*Timer_Function)(u32 id);
 
 ////////////////////////////////////////////////////////////////////////
 // Render.
 ////////////////////////////////////////////////////////////////////////
 
+// Glyph metrics in FONT_SDF_SIZE pixels, plus the glyph's atlas region.
+typedef struct character_data {
+	f32 uv_rect[4];
+	u32 advance_x;
+	u32 advance_y;
+	i32 width;
+	i32 height;
+	i32 left;
+	i32 top;
+} Character_Data;
+
+// Baked font file, written by tools/font_bake.c: this header, one
+// Character_Data per ASCII code, then the 8 bit atlas rows.
+#define FONT_FILE_PATH "./assets/font.bin"
+#define FONT_FILE_MAGIC 0x31544e46
+
+typedef struct font_file_header {
+	u32 magic;
+	u32 sdf_size;
+	u32 atlas_width;
+	u32 atlas_height;
+} Font_File_Header;
+
+// Baked texture file, written by tools/texture_bake.c: this header, one
+// Texture_File_Region per packed image, then the rows exactly as
+// glTexImage2D takes them for the format.
+#define ATLAS_FILE_PATH "./assets/atlas.tex"
+#define TEXTURE_FILE_MAGIC 0x31584554
+
+typedef enum texture_format {
+	TF_RGBA8,
+	// Half the size, for art that doesn't need the colour depth.
+	TF_RGBA4,
+	// One channel, drawn as white at that alpha.
+	TF_R8,
+	TF_COUNT,
+} Texture_Format;
+
+typedef struct texture_file_header {
+	u32 magic;
+	u32 format;
+	u32 width;
+	u32 height;
+	u32 region_count;
+} Texture_File_Header;
+
+typedef struct texture_file_region {
+	u32 x;
+	u32 y;
+	u32 width;
+	u32 height;
+} Texture_File_Region;
+
+u32 texture_format_pixel_size(u32 format);
+
+// Linked shader programs are cached in the user's pref dir, one file per
+// program: this header then the driver's binary. The key hashes the
+// preprocessed sources with the GL vendor, renderer and version, so an
+// edited shader or a new driver misses the cache and relinks.
+#define SHADER_CACHE_MAGIC 0x31485347
+
+typedef struct shader_cache_header {
+	u32 magic;
+	u32 format;
+	u64 key;
+} Shader_Cache_Header;
+
+// GL 4.1 / ARB_get_program_binary, which the 3.3 loader doesn't cover.
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+typedef void (APIENTRYP Gl_Get_Program_Binary)(GLuint program, GLsizei size, GLsizei *length, GLenum *format, void *binary);
+typedef void (APIENTRYP Gl_Program_Binary)(GLuint program, GLenum format, const void *binary, GLsizei length);
+typedef void (APIENTRYP Gl_Program_Parameteri)(GLuint program, GLenum name, GLint value);
+
+// A texture may be a region of an atlas, uv_rect is (u0, v0, u1, v1) of
+// that region and covers the whole texture otherwise.
 typedef struct texture {
 	u32 id;
 	i32 width;
 	i32 height;
 	i32 channel_count;
+	f32 uv_rect[4];
 } Texture;
 
+// One batched sprite, 32 bytes. Position is the centre, a negative width
+// flips the sprite and the UV rect is (u0, v0, u1, v1) in 16 bit fixed
+// point.
+typedef struct sprite_instance {
+	f32 position[2];
+	f32 size[2];
+	u16 uv_rect[4];
+	f32 rotation;
+	u32 color;
+} Sprite_Instance;
+
+// One batched circle or ring, 20 bytes. A ring as thick as its radius is
+// a filled circle.
+typedef struct circle_instance {
+	f32 position[2];
+	f32 radius;
+	f32 thickness;
+	u32 color;
+} Circle_Instance;
+
+// One end of a batched line, 12 bytes.
+typedef struct line_vertex {
+	f32 position[2];
+	u32 color;
+} Line_Vertex;
+
+// Uniforms every shader may use. Locations are resolved once per program.
+typedef enum uniform {
+	UNIFORM_PROJECTION,
+	UNIFORM_MODEL,
+	UNIFORM_COLOR,
+	UNIFORM_COUNT
+} Uniform;
+
+typedef enum render_command_type {
+	RC_SPRITE,
+	RC_QUAD,
+	RC_SEGMENT,
+	RC_CIRCLE,
+	RC_TEXT,
+} Render_Command_Type;
+
+// One recorded draw. Colours are packed RGBA8 and text points into the
+// frame's text array.
+typedef struct render_command {
+	u8 type;
+	u8 is_wireframe;
+	u32 texture;
+	union {
+		Sprite_Instance sprite;
+		struct {
+			f32 x;
+			f32 y;
+			f32 width;
+			f32 height;
+			u32 color;
+		} quad;
+		struct {
+			f32 start[2];
+			f32 end[2];
+			u32 color;
+		} segment;
+		Circle_Instance circle;
+		struct {
+			u32 offset;
+			u32 length;
+			f32 x;
+			f32 y;
+			f32 size;
+			u32 color;
+			u8 is_centered;
+		} text;
+	} data;
+} Render_Command;
+
+// Sort key, from the top: layer (8 bits), command type (8), texture (16),
+// depth (32).
+typedef struct render_sort_entry {
+	u64 key;
+	u32 index;
+} Render_Sort_Entry;
+
+// GL calls the state cache avoided, plus draws issued.
+typedef struct render_stats {
+	u32 program_binds_skipped;
+	u32 texture_binds_skipped;
+	u32 vao_binds_skipped;
+	u32 buffer_binds_skipped;
+	u32 uniform_lookups_skipped;
+	u32 draw_calls;
+	u32 stream_bytes;
+	u32 stream_waits;
+	u32 stream_orphans;
+	u32 commands;
+	u32 commands_dropped;
+	// Render thread time, and GPU time for each pass from a few frames ago.
+	f32 execute_ms;
+	f32 swap_ms;
+	f32 gpu_ms[GPU_TIMER_PASSES];
+} Render_Stats;
+
+// Everything recorded for one frame.
+typedef struct render_frame {
+	Render_Command *command_array;
+	Render_Sort_Entry *sort_array;
+	u32 command_count;
+	u32 dropped_count;
+	char *text_array;
+	u32 text_count;
+	// Debug lines go on top of everything in world space, two vertices
+	// each.
+	Line_Vertex *debug_vertex_array;
+	u32 debug_vertex_count;
+	mat4x4 projection;
+	i32 window_width;
+	i32 window_height;
+	// Cached layers that were drawn this frame.
+	u32 redraw_layer_mask;
+	// Counters from the last time this frame was executed.
+	Render_Stats stats;
+} Render_Frame;
+
 struct render_state {
 	SDL_Window *window;
 	SDL_Renderer *renderer;
-	mat4x4 projection;
+	// No window or GL, frames are drawn by the software rasteriser.
+	u8 is_headless;
+	Character_Data character_data_array[128];
+	u32 frame_buffer;
+	u32 frame_color_buffer;
 	u32 color_texture;
 	u32 shader;
 	u32 quad_vao;
 	u32 quad_vbo;
 	u32 quad_ebo;
 	u32 line_vao;
-	u32 line_vbo;
+	u32 line_shader;
+	u32 line_vertex_count;
+	Line_Vertex *line_vertex_array;
 	u32 text_vao;
-	u32 text_vbo;
 	u32 text_shader;
 	u32 text_texture;
 	u32 circle_shader;
+	u32 circle_vao;
+	u32 circle_count;
+	Circle_Instance *circle_instance_array;
+	u32 batch_shader;
+	u32 batch_vao;
+	u32 batch_corner_vbo;
+	u32 batch_ebo;
+	u32 batch_texture;
+	u32 batch_count;
+	Sprite_Instance *batch_instance_array;
+
+	// Null when the driver can't hand back program binaries.
+	char *shader_cache_path;
+	Gl_Get_Program_Binary gl_get_program_binary;
+	Gl_Program_Binary gl_program_binary;
+	Gl_Program_Parameteri gl_program_parameteri;
+	u64 shader_driver_hash;
+	u32 program_array[MAX_SHADERS];
+	i32 uniform_location_array[MAX_SHADERS][UNIFORM_COUNT];
+	u32 program_count;
+	u32 bound_program;
+	u32 bound_program_index;
+	u32 bound_texture;
+	u32 bound_vao;
+	u32 bound_array_buffer;
+	u32 stream_vbo;
+	u32 stream_frame;
+	u32 stream_offset;
+	GLsync stream_fence_array[STREAM_FRAME_COUNT];
+	// Counts for the frame executing and the last finished frame the main
+	// thread has seen.
+	Render_Stats stats;
+	Render_Stats frame_stats;
+
+	Render_Frame frame_array[2];
+	Render_Frame *frame;
+	u32 frame_index;
+	Render_Sort_Entry *sort_scratch_array;
+	SDL_GLContext context;
+	SDL_Thread *thread;
+	SDL_sem *frame_ready;
+	SDL_sem *frame_free;
+	u8 layer;
+	u8 is_wireframe;
+	u8 is_debug_enabled;
+
+	mat4x4 screen_projection;
+	u32 layer_frame_buffer_array[MAX_CACHED_LAYERS];
+	u32 layer_texture_array[MAX_CACHED_LAYERS];
+	u32 cached_layer_mask;
+	u32 world_layer_mask;
+	u32 dirty_layer_mask;
+
+	// Ring of GL_TIME_ELAPSED queries. A slot is read just before it is
+	// reused, by which time the GPU has long finished with it.
+	u32 gpu_query_array[GPU_TIMER_FRAMES][GPU_TIMER_PASSES];
+	u32 gpu_query_issued_array[GPU_TIMER_FRAMES];
+	u32 gpu_query_frame;
 
 	f32 screen_shake_timer;
 	f32 screen_shake_magnitude;
 };
 
-void render_setup();
+void render_setup(u8 is_headless);
 void render_quad(f32 x, f32 y, f32 width, f32 height, vec4 color);
 void render_circle(f32 x, f32 y, f32 radius, vec4 color);
+void render_ring(f32 x, f32 y, f32 radius, f32 thickness, vec4 color);
 void render_text(const char *text, f32 x, f32 y, vec4 color, u8 is_centered);
-void render_sprite(Texture texture, f32 size[2], vec3 position, f32 tex_coords[8], f32 rotation, vec4 color, u8 is_flipped);
+void render_text_sized(const char *text, f32 x, f32 y, f32 size, vec4 color, u8 is_centered);
+void render_sprite(Texture texture, f32 size[2], vec3 position, f32 uv_rect[4], f32 rotation, vec4 color, u8 is_flipped);
 void render_point(vec2 position, vec4 color);
 void render_aabb(AABB aabb, vec4 color);
 void render_segment(vec2 start, vec2 end, vec4 color);
 void render_ray(vec2 start, vec2 direction, f32 length, vec4 color, u8 arrow);
 Texture render_texture_create(const char *path);
+void render_atlas_load(const char *path, u32 count, Texture *texture_array);
 void render_screen_shake_add(f32 duration, f32 magnitude);
 void render_screen_shake(f32 delta_time);
+AABB render_view_get();
+u8 render_rect_is_visible(AABB view, f32 x, f32 y, f32 width, f32 height);
 void render_sprite_sheet_frame(Sprite_Sheet sprite_sheet, u8 row, u8 column, vec3 position, f32 rotation, vec4 color, u8 is_flipped);
+void render_begin();
+u8 render_layer_set(u8 layer);
+void render_layer_cache(u8 layer, u8 is_world);
+void render_layer_dirty(u8 layer);
+void render_wireframe_set(u8 is_wireframe);
+void render_end();
+void render_fullscreen_toggle();
+void render_debug_set(u8 is_enabled);
+void render_debug_toggle();
+u8 render_debug_is_enabled();
+void render_debug_line(vec2 start, vec2 end, vec4 color);
+void render_debug_aabb(AABB aabb, vec4 color);
+void render_debug_point(vec2 position, vec4 color);
+void render_wait();
+
+////////////////////////////////////////////////////////////////////////
+// Software rendering.
+////////////////////////////////////////////////////////////////////////
+
+#define MAX_SOFT_TEXTURES 8
+#define MAX_SOFT_THREADS 8
+#define SOFT_TILE_SIZE 32
+
+// RGBA8 pixels, packed as by color_pack.
+typedef struct soft_texture {
+	u32 *pixels;
+	i32 width;
+	i32 height;
+} Soft_Texture;
+
+// A sprite worked out once per frame: its pixel bounds (x0, y0, x1, y1)
+// and the map from a pixel back to (u, v) across the sprite.
+typedef struct soft_sprite {
+	mat2x3 inverse;
+	i32 bounds[4];
+} Soft_Sprite;
+
+typedef struct render_soft_state {
+	u32 *pixels;
+	Soft_Texture texture_array[MAX_SOFT_TEXTURES];
+	u32 texture_count;
+	// The frame being executed, shared with the workers.
+	Render_Frame *frame;
+	Render_Sort_Entry *sorted;
+	// Indexed like the frame's command array.
+	Soft_Sprite *sprite_array;
+	u32 thread_count;
+	SDL_Thread *thread_array[MAX_SOFT_THREADS];
+	SDL_sem *start_array[MAX_SOFT_THREADS];
+	SDL_sem *done;
+} Render_Soft_State;
+
+void render_soft_setup();
+u32 render_soft_texture_create(const u8 *pixels, i32 width, i32 height, i32 channel_count);
+void render_soft_execute(Render_Frame *frame, Render_Sort_Entry *sorted);
+void render_soft_write_ppm(const char *path);
+
+////////////////////////////////////////////////////////////////////////
+// Profiler.
+////////////////////////////////////////////////////////////////////////
+
+typedef enum profile_scope {
+	PS_FRAME,
+	PS_INPUT,
+	PS_WAIT,
+	PS_SIMULATE,
+	PS_ANIMATION,
+	PS_SUBMIT,
+	// Filled in from the render thread's counters.
+	PS_EXECUTE,
+	PS_SWAP,
+	PS_COUNT,
+} Profile_Scope;
+
+typedef struct profile_frame {
+	f32 cpu_ms[PS_COUNT];
+	f32 gpu_ms[GPU_TIMER_PASSES];
+} Profile_Frame;
+
+typedef struct profile_state {
+	Profile_Frame frame_array[PROFILE_HISTORY];
+	u32 frame_index;
+	u32 frame_count;
+	Profile_Scope scope_stack[MAX_PROFILE_DEPTH];
+	u64 start_stack[MAX_PROFILE_DEPTH];
+	u32 depth;
+	// How deep each scope was last opened, for indenting the overlay.
+	u8 depth_array[PS_COUNT];
+	f64 ms_per_tick;
+	u8 is_visible;
+} Profile_State;
+
+void profile_setup();
+void profile_begin(Profile_Scope scope);
+void profile_end();
+void profile_frame_end();
+void profile_toggle();
+void profile_render();
 
 ////////////////////////////////////////////////////////////////////////
 // Physics.
@@ -164,7 +618,29 @@ struct collision {
 	Hit hit;
 };
 
+// Uniform grid with a linked list of ids per cell. Items are inserted into
+// every cell their AABB overlaps; anything outside the grid is clamped to
+// the border cells.
+struct spatial_grid {
+	vec2 origin;
+	f32 cell_size;
+	u32 columns;
+	u32 rows;
+	u32 *cell_head_array;
+	u32 *node_id_array;
+	u32 *node_next_array;
+	u32 node_count;
+	u32 node_array_max;
+	// Stamps let a query report each id once even if it spans cells.
+	u32 *stamp_array;
+	u32 stamp;
+	u32 id_max;
+};
+
 struct physics_state {
+	// Rebuilt at the end of every physics tick.
+	Spatial_Grid entity_grid;
+	Spatial_Grid static_body_grid;
 	u32 static_body_array_count;
 	u32 static_body_array_max;
 	Static_Body *static_body_array;
@@ -179,46 +655,180 @@ void physics_tick(f32 delta_time, Entity *entity_array);
 Static_Body *physics_static_body_create(f32 x, f32 y, f32 half_width, f32 half_height, u8 layer_mask);
 Trigger *physics_trigger_create(f32 x, f32 y, f32 half_width, f32 half_height);
 Hit *aabb_intersect_aabb(AABB self, AABB other);
+u8 segment_intersect_aabb(vec2 start, vec2 delta, AABB aabb, f32 padding, Hit *hit);
+u8 physics_can_collide(u8 a_id, u8 b_id);
 void physics_cleanup();
 
+void spatial_grid_init(Spatial_Grid *grid, f32 x, f32 y, f32 width, f32 height, f32 cell_size, u32 id_max);
+void spatial_grid_clear(Spatial_Grid *grid);
+void spatial_grid_insert(Spatial_Grid *grid, u32 id, AABB aabb);
+u32 spatial_grid_query(Spatial_Grid *grid, AABB area, u32 *id_array, u32 id_array_max);
+void spatial_grid_render(Spatial_Grid *grid, vec4 color);
+
 ////////////////////////////////////////////////////////////////////////
 // Entity.
 ////////////////////////////////////////////////////////////////////////
 
+// Data shared by every entity of a kind. Entities refer to it by index.
+struct entity_type {
+	vec2 half_sizes;
+	vec2 sprite_offset;
+	On_Collide_Function on_collide;
+	On_Collide_Static_Function on_collide_static;
+	u8 layer_mask;
+	u8 is_kinematic;
+};
+
+// Kept to exactly one cache line. Anything constant per kind of entity
+// belongs in Entity_Type instead. The collider half sizes are copied from
+// the type so collision tests don't have to look it up.
 struct entity {
 	AABB aabb;
 	vec2 velocity;
-	vec2 last_velocity;
 	vec2 desired_velocity;
 	vec2 acceleration;
 	f32 rotation;
-
-	u32 animation_id;
-	vec2 sprite_size;
-	vec2 sprite_offset;
-	vec4 sprite_color;
-	vec4 desired_sprite_color;
-	vec4 sprite_color_delta;
-
-	On_Collide_Function on_collide;
-	On_Collide_Static_Function on_collide_static;
-	f32 time_to_live;
-	u8 is_in_use;
-	u8 is_flipped;
-	u8 is_grounded;
-	u8 is_kinematic;
+	// RGBA8, red in the lowest byte.
+	u32 sprite_color;
+	u32 tags;
+	u32 lifetime_timer;
+	// Index + 1 of the active colour tween, 0 when there is none.
+	u16 color_tween;
+	u8 type_id;
+	u8 animation_id;
 	u8 layer_mask;
 	i8 health;
+	bool is_in_use : 1;
+	bool is_flipped : 1;
+	bool is_grounded : 1;
+	bool is_kinematic : 1;
+	// Vertical velocity was non-zero at the start of the physics tick.
+	bool was_airborne : 1;
 };
 
 struct entity_state {
 	Entity *entity_array;
 	u32 entity_array_count;
+	Entity_Type entity_type_array[MAX_ENTITY_TYPES];
+	u32 entity_type_array_count;
+	// Each tag keeps a dense array of member ids for iteration and a
+	// sparse id -> position index so adding and removing are O(1).
+	u32 *tag_member_array[MAX_ENTITY_TAGS];
+	u32 tag_member_count[MAX_ENTITY_TAGS];
+	u16 *tag_index_array[MAX_ENTITY_TAGS];
 };
 
 void entity_setup();
-u32 entity_create(f32 x, f32 y, f32 collider_half_width, f32 collider_half_height, f32 sprite_width, f32 sprite_height, f32 sprite_offset_x, f32 sprite_offset_y, u32 layer_mask, u32 initial_animation_id);
+u32 entity_type_create(f32 collider_half_width, f32 collider_half_height, f32 sprite_offset_x, f32 sprite_offset_y, u8 layer_mask, u8 is_kinematic, On_Collide_Function on_collide, On_Collide_Static_Function on_collide_static);
+u32 entity_create(f32 x, f32 y, u32 type_id, u32 initial_animation_id);
 void entity_destroy(u32 index);
+void entity_tag_add(u32 index, u32 tag);
+void entity_tag_remove(u32 index, u32 tag);
+u8 entity_tag_has(u32 index, u32 tag);
+u32 *entity_tag_query(u32 tag, u32 *count);
+u32 entity_tag_query_radius(u32 tag, vec2 position, f32 radius, u32 *id_array, u32 id_array_max);
+void entity_lifetime_set(u32 index, f32 seconds);
+
+////////////////////////////////////////////////////////////////////////
+// Timers.
+////////////////////////////////////////////////////////////////////////
+
+// Handles pack a generation in the high 16 bits and the slot index in
+// the low 16 bits. 0 is never a valid handle.
+struct timer {
+	u32 expiry_tick;
+	u32 next;
+	u32 prev;
+	u32 id;
+	Timer_Function on_expire;
+	u16 generation;
+	u16 slot;
+};
+
+struct timer_state {
+	Timer *timer_array;
+	u32 free_head;
+	u32 active_count;
+	u32 current_tick;
+	f32 tick_remainder;
+	// One list head per wheel slot plus the list currently being fired.
+	u32 slot_head_array[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS + 1];
+};
+
+void timer_setup();
+u32 timer_schedule(f32 seconds, Timer_Function on_expire, u32 id);
+void timer_cancel(u32 handle);
+u8 timer_is_active(u32 handle);
+f32 timer_remaining(u32 handle);
+void timer_tick(f32 delta_time);
+
+////////////////////////////////////////////////////////////////////////
+// Tweens.
+////////////////////////////////////////////////////////////////////////
+
+typedef enum tween_ease {
+	TE_LINEAR,
+	TE_IN,
+	TE_OUT,
+	TE_IN_OUT,
+	TE_COUNT
+} Tween_Ease;
+
+// Structure of arrays holding only the active tweens.
+struct tween_state {
+	u32 count;
+	u32 *entity_id_array;
+	f32 *elapsed_array;
+	f32 *inverse_duration_array;
+	f32 *ease_a_array;
+	f32 *ease_b_array;
+	f32 *ease_c_array;
+	vec4 *from_array;
+	vec4 *delta_array;
+};
+
+void tween_setup();
+void tween_color(u32 entity_id, vec4 to, f32 duration, Tween_Ease ease);
+void tween_cancel(u32 entity_id);
+void tween_tick(f32 delta_time);
+
+////////////////////////////////////////////////////////////////////////
+// Projectiles.
+////////////////////////////////////////////////////////////////////////
+
+struct projectile_hit {
+	Hit hit;
+	u32 target_id;
+	u32 owner_id;
+	u8 damage;
+	u8 is_static;
+};
+
+// Structure of arrays, padded so four projectiles can always be moved
+// together. Projectiles do not take part in entity collision; they sweep
+// their movement against the spatial grids and report hits instead.
+struct projectile_state {
+	u32 count;
+	f32 *position_x_array;
+	f32 *position_y_array;
+	f32 *velocity_x_array;
+	f32 *velocity_y_array;
+	f32 *time_to_live_array;
+	f32 *half_size_array;
+	u32 *owner_array;
+	u8 *damage_array;
+	u8 *layer_mask_array;
+	u8 *animation_id_array;
+
+	Projectile_Hit hit_array[MAX_PROJECTILE_HITS];
+	u32 hit_array_count;
+};
+
+void projectile_setup();
+void projectile_spawn(f32 x, f32 y, f32 velocity_x, f32 velocity_y, f32 time_to_live, f32 half_size, u8 damage, u32 owner_id, u8 layer_mask, u32 animation_id);
+void projectile_tick(f32 delta_time);
+void projectile_render();
+void projectile_clear();
 
 ////////////////////////////////////////////////////////////////////////
 // User input.
@@ -0,0 +1,192 @@
+#include "shared.h"
+
+Timer_State timer_state = {0};
+static Timer_State *state = &timer_state;
+
+// Hierarchical timer wheel.
+//
+// Level 0 has one slot per tick, each level above covers a full turn of
+// the level below it. A timer is filed at the lowest level whose range
+// contains its expiry and is moved down (cascaded) when the level below
+// wraps around to it. Scheduling and cancelling are O(1) list operations
+// and a tick only touches the timers that are due, so idle timers cost
+// nothing per frame.
+
+#define TIMER_NONE 0xffffffff
+#define TIMER_SLOT_FREE 0xffff
+#define TIMER_SLOT_FIRING (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS)
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_MAX_DELTA ((1u << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+static void list_push(u32 slot, u32 index) {
+	Timer *timer = &state->timer_array[index];
+	timer->slot = slot;
+	timer->prev = TIMER_NONE;
+	timer->next = state->slot_head_array[slot];
+	if (timer->next != TIMER_NONE)
+		state->timer_array[timer->next].prev = index;
+	state->slot_head_array[slot] = index;
+}
+
+static void list_remove(u32 index) {
+	Timer *timer = &state->timer_array[index];
+	if (timer->prev != TIMER_NONE)
+		state->timer_array[timer->prev].next = timer->next;
+	else
+		state->slot_head_array[timer->slot] = timer->next;
+	if (timer->next != TIMER_NONE)
+		state->timer_array[timer->next].prev = timer->prev;
+}
+
+static void wheel_insert(u32 index) {
+	Timer *timer = &state->timer_array[index];
+	u32 delta = timer->expiry_tick - state->current_tick;
+
+	u32 level = 0;
+	while (level < TIMER_WHEEL_LEVELS - 1 && delta >= 1u << (TIMER_WHEEL_BITS * (level + 1)))
+		++level;
+
+	u32 slot = (timer->expiry_tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+	list_push(level * TIMER_WHEEL_SLOTS + slot, index);
+}
+
+static void timer_free(u32 index) {
+	Timer *timer = &state->timer_array[index];
+	timer->slot = TIMER_SLOT_FREE;
+	timer->on_expire = NULL;
+	// Bump the generation so stale handles stop matching. Zero is skipped
+	// so a valid handle is never 0.
+	if (++timer->generation == 0)
+		timer->generation = 1;
+	timer->next = state->free_head;
+	state->free_head = index;
+	--state->active_count;
+}
+
+static Timer *timer_from_handle(u32 handle) {
+	u32 index = handle & 0xffff;
+	if (handle == 0 || index >= MAX_TIMERS)
+		return NULL;
+
+	Timer *timer = &state->timer_array[index];
+	if (timer->slot == TIMER_SLOT_FREE || timer->generation != handle >> 16)
+		return NULL;
+
+	return timer;
+}
+
+static void cascade(u32 level) {
+	u32 slot = level * TIMER_WHEEL_SLOTS + ((state->current_tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+	u32 index = state->slot_head_array[slot];
+	state->slot_head_array[slot] = TIMER_NONE;
+
+	while (index != TIMER_NONE) {
+		u32 next = state->timer_array[index].next;
+		wheel_insert(index);
+		index = next;
+	}
+}
+
+static void advance() {
+	++state->current_tick;
+
+	// Pull timers down from the higher levels that just came into range,
+	// highest first so they can fall through more than one level.
+	u32 levels_wrapped = 0;
+	while (levels_wrapped < TIMER_WHEEL_LEVELS - 1 && (state->current_tick & ((1u << (TIMER_WHEEL_BITS * (levels_wrapped + 1))) - 1)) == 0)
+		++levels_wrapped;
+	for (u32 level = levels_wrapped; level > 0; --level)
+		cascade(level);
+
+	// Move the due slot to the firing list first. Callbacks may schedule
+	// or cancel timers, including ones that are about to fire.
+	u32 slot = state->current_tick & TIMER_WHEEL_MASK;
+	u32 index = state->slot_head_array[slot];
+	state->slot_head_array[slot] = TIMER_NONE;
+	state->slot_head_array[TIMER_SLOT_FIRING] = index;
+	while (index != TIMER_NONE) {
+		state->timer_array[index].slot = TIMER_SLOT_FIRING;
+		index = state->timer_array[index].next;
+	}
+
+	while ((index = state->slot_head_array[TIMER_SLOT_FIRING]) != TIMER_NONE) {
+		Timer *timer = &state->timer_array[index];
+		Timer_Function on_expire = timer->on_expire;
+		u32 id = timer->id;
+
+		list_remove(index);
+		timer_free(index);
+
+		if (on_expire != NULL)
+			on_expire(id);
+	}
+}
+
+void timer_setup() {
+	state->timer_array = calloc(MAX_TIMERS, sizeof(*state->timer_array));
+
+	for (u32 i = 0; i < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS + 1; ++i)
+		state->slot_head_array[i] = TIMER_NONE;
+
+	for (u32 i = 0; i < MAX_TIMERS; ++i) {
+		state->timer_array[i].slot = TIMER_SLOT_FREE;
+		state->timer_array[i].generation = 1;
+		state->timer_array[i].next = i + 1 < MAX_TIMERS ? i + 1 : TIMER_NONE;
+	}
+	state->free_head = 0;
+}
+
+u32 timer_schedule(f32 seconds, Timer_Function on_expire, u32 id) {
+	if (state->free_head == TIMER_NONE) {
+		error_and_exit(EXIT_FAILURE, "No timers left.");
+	}
+
+	u32 index = state->free_head;
+	Timer *timer = &state->timer_array[index];
+	state->free_head = timer->next;
+	++state->active_count;
+
+	// Always at least one tick away so a timer never fires in the slot
+	// that is currently being processed.
+	f32 ticks = seconds * TIMER_TICKS_PER_SECOND + state->tick_remainder;
+	u32 delta = ticks < 1 ? 1 : ticks >= TIMER_MAX_DELTA ? TIMER_MAX_DELTA : (u32)ceilf(ticks);
+
+	timer->expiry_tick = state->current_tick + delta;
+	timer->on_expire = on_expire;
+	timer->id = id;
+	wheel_insert(index);
+
+	return (u32)timer->generation << 16 | index;
+}
+
+void timer_cancel(u32 handle) {
+	Timer *timer = timer_from_handle(handle);
+	if (timer == NULL)
+		return;
+
+	u32 index = handle & 0xffff;
+	list_remove(index);
+	timer_free(index);
+}
+
+u8 timer_is_active(u32 handle) {
+	return timer_from_handle(handle) != NULL;
+}
+
+f32 timer_remaining(u32 handle) {
+	Timer *timer = timer_from_handle(handle);
+	if (timer == NULL)
+		return 0;
+
+	f32 ticks = (f32)(timer->expiry_tick - state->current_tick) - state->tick_remainder;
+	return ticks > 0 ? ticks / TIMER_TICKS_PER_SECOND : 0;
+}
+
+void timer_tick(f32 delta_time) {
+	state->tick_remainder += delta_time * TIMER_TICKS_PER_SECOND;
+	while (state->tick_remainder >= 1) {
+		state->tick_remainder -= 1;
+		advance();
+	}
+}
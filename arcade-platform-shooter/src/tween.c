@@ -0,0 +1,133 @@
+#include "shared.h"
+
+Tween_State tween_state = {0};
+static Tween_State *state = &tween_state;
+
+extern Entity_State entity_state;
+
+// Only active tweens are stored, packed at the front of the arrays, so
+// entities without a tween cost nothing. Every easing curve is a cubic
+// e(t) = ((a * t + b) * t + c) * t which lets four tweens with different
+// curves be evaluated together.
+static const f32 EASE_COEFFICIENTS[TE_COUNT][3] = {
+	[TE_LINEAR] = {0, 0, 1},
+	[TE_IN] = {0, 1, 0},
+	[TE_OUT] = {0, -1, 2},
+	[TE_IN_OUT] = {-2, 3, 0},
+};
+
+void tween_setup() {
+	// Rounded up to a multiple of four so the SIMD loop can always read
+	// whole groups.
+	u32 capacity = (MAX_TWEENS + 3) & ~3u;
+	state->entity_id_array = calloc(capacity, sizeof(*state->entity_id_array));
+	state->elapsed_array = calloc(capacity, sizeof(*state->elapsed_array));
+	state->inverse_duration_array = calloc(capacity, sizeof(*state->inverse_duration_array));
+	state->ease_a_array = calloc(capacity, sizeof(*state->ease_a_array));
+	state->ease_b_array = calloc(capacity, sizeof(*state->ease_b_array));
+	state->ease_c_array = calloc(capacity, sizeof(*state->ease_c_array));
+	state->from_array = calloc(capacity, sizeof(*state->from_array));
+	state->delta_array = calloc(capacity, sizeof(*state->delta_array));
+}
+
+static void tween_remove(u32 index) {
+	Entity *entity_array = entity_state.entity_array;
+	entity_array[state->entity_id_array[index]].color_tween = 0;
+
+	u32 last = --state->count;
+	if (index == last)
+		return;
+
+	state->entity_id_array[index] = state->entity_id_array[last];
+	state->elapsed_array[index] = state->elapsed_array[last];
+	state->inverse_duration_array[index] = state->inverse_duration_array[last];
+	state->ease_a_array[index] = state->ease_a_array[last];
+	state->ease_b_array[index] = state->ease_b_array[last];
+	state->ease_c_array[index] = state->ease_c_array[last];
+	memcpy(state->from_array[index], state->from_array[last], sizeof(vec4));
+	memcpy(state->delta_array[index], state->delta_array[last], sizeof(vec4));
+	entity_array[state->entity_id_array[index]].color_tween = index + 1;
+}
+
+void tween_color(u32 entity_id, vec4 to, f32 duration, Tween_Ease ease) {
+	Entity *entity = &entity_state.entity_array[entity_id];
+
+	// Retarget an existing tween from wherever the colour is now.
+	u32 index = entity->color_tween - 1;
+	if (entity->color_tween == 0) {
+		if (state->count == MAX_TWEENS) {
+			error_and_exit(EXIT_FAILURE, "No tweens left.");
+		}
+		index = state->count++;
+		entity->color_tween = index + 1;
+	}
+
+	state->entity_id_array[index] = entity_id;
+	state->elapsed_array[index] = 0;
+	state->inverse_duration_array[index] = duration > 0 ? 1 / duration : FLT_MAX;
+	state->ease_a_array[index] = EASE_COEFFICIENTS[ease][0];
+	state->ease_b_array[index] = EASE_COEFFICIENTS[ease][1];
+	state->ease_c_array[index] = EASE_COEFFICIENTS[ease][2];
+	color_unpack(entity->sprite_color, state->from_array[index]);
+	for (u32 i = 0; i < 4; ++i) {
+		state->delta_array[index][i] = to[i] - state->from_array[index][i];
+	}
+}
+
+void tween_cancel(u32 entity_id) {
+	Entity *entity = &entity_state.entity_array[entity_id];
+	if (entity->color_tween != 0)
+		tween_remove(entity->color_tween - 1);
+}
+
+void tween_tick(f32 delta_time) {
+	Entity *entity_array = entity_state.entity_array;
+
+#if HAS_SSE2
+	__m128 dt = _mm_set1_ps(delta_time);
+	__m128 one = _mm_set1_ps(1);
+	__m128 zero = _mm_setzero_ps();
+	__m128 scale = _mm_set1_ps(255);
+	for (u32 i = 0; i < state->count; i += 4) {
+		__m128 elapsed = _mm_add_ps(_mm_loadu_ps(&state->elapsed_array[i]), dt);
+		_mm_storeu_ps(&state->elapsed_array[i], elapsed);
+
+		__m128 t = _mm_min_ps(_mm_mul_ps(elapsed, _mm_loadu_ps(&state->inverse_duration_array[i])), one);
+		__m128 e = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&state->ease_a_array[i]), t), _mm_loadu_ps(&state->ease_b_array[i]));
+		e = _mm_add_ps(_mm_mul_ps(e, t), _mm_loadu_ps(&state->ease_c_array[i]));
+		e = _mm_mul_ps(e, t);
+
+		f32 eased[4];
+		_mm_storeu_ps(eased, e);
+
+		u32 lanes = state->count - i < 4 ? state->count - i : 4;
+		for (u32 j = 0; j < lanes; ++j) {
+			__m128 color = _mm_add_ps(_mm_loadu_ps(state->from_array[i + j]), _mm_mul_ps(_mm_loadu_ps(state->delta_array[i + j]), _mm_set1_ps(eased[j])));
+
+			// Quantise to RGBA8: clamp, scale, round and narrow 32 -> 16 -> 8 bits.
+			__m128i channels = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(color, zero), one), scale));
+			channels = _mm_packs_epi32(channels, channels);
+			channels = _mm_packus_epi16(channels, channels);
+			entity_array[state->entity_id_array[i + j]].sprite_color = (u32)_mm_cvtsi128_si32(channels);
+		}
+	}
+#else
+	for (u32 i = 0; i < state->count; ++i) {
+		state->elapsed_array[i] += delta_time;
+		f32 t = fminf(state->elapsed_array[i] * state->inverse_duration_array[i], 1);
+		f32 e = ((state->ease_a_array[i] * t + state->ease_b_array[i]) * t + state->ease_c_array[i]) * t;
+
+		vec4 color;
+		for (u32 j = 0; j < 4; ++j)
+			color[j] = state->from_array[i][j] + state->delta_array[i][j] * e;
+		entity_array[state->entity_id_array[i]].sprite_color = color_pack(color);
+	}
+#endif
+
+	// Retire finished tweens. Walking backwards means the swap in
+	// tween_remove only ever moves a tween that was already checked.
+	for (u32 i = state->count; i-- > 0;) {
+		if (state->elapsed_array[i] * state->inverse_duration_array[i] >= 1)
+			tween_remove(i);
+	}
+}
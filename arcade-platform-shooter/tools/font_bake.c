@@ -0,0 +1,93 @@
+// Rasterises a font into the signed distance field glyph atlas the game
+// loads at startup, so the game itself never touches FreeType.
+//
+// Build and run with `make font`, or:
+//     font_bake.out <font.ttf> <font.bin>
+
+#include "../src/shared.h"
+#include "../src/engine/io.h"
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+int main(int argc, char **argv) {
+	const char *font_path = argc > 1 ? argv[1] : "./assets/8-BIT_WONDER.TTF";
+	const char *out_path = argc > 2 ? argv[2] : FONT_FILE_PATH;
+
+	FT_Library ft;
+	if (FT_Init_FreeType(&ft)) {
+		error_and_exit(EXIT_FAILURE, "Could not init freetype.");
+	}
+
+	FT_Face face;
+	if (FT_New_Face(ft, font_path, 0, &face)) {
+		error_and_exit(EXIT_FAILURE, "Could not load font.");
+	}
+
+	FT_Set_Pixel_Sizes(face, 0, FONT_SDF_SIZE);
+	FT_GlyphSlot g = face->glyph;
+
+	Character_Data character_data_array[128] = {0};
+	Atlas_Image glyph_array[128] = {0};
+
+	for (u32 i = 0; i < 128; ++i) {
+		if (FT_Load_Char(face, i, FT_LOAD_DEFAULT) || FT_Render_Glyph(g, FT_RENDER_MODE_SDF)) {
+			printf("Failed to load glyph %u\n", i);
+			continue;
+		}
+
+		Atlas_Image *glyph = &glyph_array[i];
+		glyph->width = g->bitmap.width;
+		glyph->height = g->bitmap.rows;
+		glyph->pixels = malloc(glyph->width * glyph->height + 1);
+		for (i32 row = 0; row < glyph->height; ++row) {
+			memcpy(&glyph->pixels[row * glyph->width], &g->bitmap.buffer[row * g->bitmap.pitch], glyph->width);
+		}
+
+		Character_Data *character_data = &character_data_array[i];
+		character_data->advance_x = g->advance.x;
+		character_data->advance_y = g->advance.y;
+		character_data->width = g->bitmap.width;
+		character_data->height = g->bitmap.rows;
+		character_data->top = g->bitmap_top;
+		character_data->left = g->bitmap_left;
+	}
+
+	FT_Done_Face(face);
+	FT_Done_FreeType(ft);
+
+	i32 width;
+	i32 height;
+	if (!atlas_pack(glyph_array, 128, MAX_ATLAS_SIZE, &width, &height)) {
+		error_and_exit(EXIT_FAILURE, "Glyphs do not fit in the atlas.");
+	}
+
+	Font_File_Header header = {FONT_FILE_MAGIC, FONT_SDF_SIZE, width, height};
+	size_t size = sizeof(header) + sizeof(character_data_array) + width * height;
+	u8 *file = calloc(size, 1);
+	u8 *pixels = file + sizeof(header) + sizeof(character_data_array);
+
+	for (u32 i = 0; i < 128; ++i) {
+		Atlas_Image *glyph = &glyph_array[i];
+		for (i32 row = 0; row < glyph->height; ++row) {
+			memcpy(&pixels[(glyph->y + row) * width + glyph->x], &glyph->pixels[row * glyph->width], glyph->width);
+		}
+		free(glyph->pixels);
+
+		Character_Data *character_data = &character_data_array[i];
+		character_data->uv_rect[0] = (f32)glyph->x / width;
+		character_data->uv_rect[1] = (f32)glyph->y / height;
+		character_data->uv_rect[2] = (f32)(glyph->x + glyph->width) / width;
+		character_data->uv_rect[3] = (f32)(glyph->y + glyph->height) / height;
+	}
+
+	memcpy(file, &header, sizeof(header));
+	memcpy(file + sizeof(header), character_data_array, sizeof(character_data_array));
+
+	if (io_file_write(file, size, out_path)) {
+		error_and_exit(EXIT_FAILURE, "Could not write font file.");
+	}
+
+	free(file);
+	return 0;
+}
@@ -0,0 +1,119 @@
+// Decodes images, packs them into one atlas and writes it in the format
+// the GPU takes it, so the game can map the file and upload it as is.
+//
+// Build and run with `make textures`, or:
+//     texture_bake.out [-f rgba8|rgba4|r8] <out.tex> <image>...
+//
+// Regions are written in the order the images are given. For r8 the
+// image's alpha is kept and the colour dropped.
+
+#include "../src/shared.h"
+#include "../src/engine/io.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../deps/lib/stb_image.h"
+
+static u32 format_parse(const char *name) {
+	if (strcmp(name, "rgba8") == 0)
+		return TF_RGBA8;
+	if (strcmp(name, "rgba4") == 0)
+		return TF_RGBA4;
+	if (strcmp(name, "r8") == 0)
+		return TF_R8;
+	error_and_exit(EXIT_FAILURE, "Unknown format, expected rgba8, rgba4 or r8.");
+	return TF_COUNT;
+}
+
+// Rounds each channel to the nearest of 16 levels.
+static u16 rgba4_pack(const u8 *texel) {
+	u16 packed = 0;
+	for (u32 i = 0; i < 4; ++i)
+		packed = packed << 4 | (texel[i] * 15 + 127) / 255;
+	return packed;
+}
+
+int main(int argc, char **argv) {
+	u32 format = TF_RGBA8;
+	i32 arg = 1;
+	if (argc > 2 && strcmp(argv[1], "-f") == 0) {
+		format = format_parse(argv[2]);
+		arg = 3;
+	}
+
+	if (argc - arg < 2) {
+		error_and_exit(EXIT_FAILURE, "Usage: texture_bake.out [-f rgba8|rgba4|r8] <out.tex> <image>...");
+	}
+
+	const char *out_path = argv[arg++];
+	u32 count = argc - arg;
+	if (count > MAX_ATLAS_PACK_IMAGES) {
+		error_and_exit(EXIT_FAILURE, "Too many images for the atlas.");
+	}
+
+	// GL expects the bottom row first.
+	stbi_set_flip_vertically_on_load(1);
+
+	Atlas_Image image_array[MAX_ATLAS_PACK_IMAGES];
+	for (u32 i = 0; i < count; ++i) {
+		i32 channel_count;
+		Atlas_Image *image = &image_array[i];
+		image->pixels = stbi_load(argv[arg + i], &image->width, &image->height, &channel_count, 4);
+		if (!image->pixels) {
+			printf("Failed to load %s\n", argv[arg + i]);
+			error_and_exit(EXIT_FAILURE, "Failed to load image.");
+		}
+	}
+
+	i32 width;
+	i32 height;
+	if (!atlas_pack(image_array, count, MAX_ATLAS_SIZE, &width, &height)) {
+		error_and_exit(EXIT_FAILURE, "Images do not fit in the atlas.");
+	}
+
+	u8 *atlas = calloc(width * height, 4);
+	for (u32 i = 0; i < count; ++i) {
+		Atlas_Image *image = &image_array[i];
+		for (i32 row = 0; row < image->height; ++row) {
+			memcpy(&atlas[((image->y + row) * width + image->x) * 4], &image->pixels[row * image->width * 4], image->width * 4);
+		}
+		stbi_image_free(image->pixels);
+	}
+
+	u32 pixel_size = texture_format_pixel_size(format);
+	size_t size = sizeof(Texture_File_Header) + count * sizeof(Texture_File_Region) + (size_t)width * height * pixel_size;
+	u8 *file = calloc(size, 1);
+
+	Texture_File_Header header = {TEXTURE_FILE_MAGIC, format, width, height, count};
+	memcpy(file, &header, sizeof(header));
+
+	Texture_File_Region *region_array = (Texture_File_Region *)(file + sizeof(header));
+	for (u32 i = 0; i < count; ++i) {
+		Atlas_Image *image = &image_array[i];
+		region_array[i] = (Texture_File_Region){image->x, image->y, image->width, image->height};
+	}
+
+	u8 *pixels = file + sizeof(header) + count * sizeof(Texture_File_Region);
+	for (i32 i = 0; i < width * height; ++i) {
+		u8 *texel = &atlas[i * 4];
+		switch (format) {
+		case TF_RGBA8:
+			memcpy(&pixels[i * 4], texel, 4);
+			break;
+		case TF_RGBA4: {
+			u16 packed = rgba4_pack(texel);
+			memcpy(&pixels[i * 2], &packed, 2);
+		} break;
+		case TF_R8:
+			pixels[i] = texel[3];
+			break;
+		}
+	}
+
+	if (io_file_write(file, size, out_path)) {
+		error_and_exit(EXIT_FAILURE, "Could not write texture file.");
+	}
+
+	free(atlas);
+	free(file);
+	return 0;
+}